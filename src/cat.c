@@ -4,6 +4,9 @@
    by tege@sics.se, Torbjorn Granlund, advised by rms, Richard Stallman.  */
 #include <config.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <sys/types.h>
 
@@ -11,15 +14,46 @@
 #include <stropts.h>
 #endif
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/sysmacros.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <signal.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#if defined __has_include
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define USE_IO_URING 1
+#endif
+#if __has_include(<linux/perf_event.h>)
+#include <linux/perf_event.h>
+#define USE_PERF_EVENTS 1
+#endif
+#endif
+#endif
 
+#if defined __x86_64__ && defined __GNUC__
+#include <immintrin.h>
+#define USE_SIMD_SCAN 1
+#endif
+
+#include "argmatch.h"
+#include "cat_format.h"
 #include "die.h"
 #include "error.h"
 #include "fadvise.h"
 #include "full-write.h"
+#include "gethrxtime.h"
 #include "ioblksize.h"
+#include "nproc.h"
 #include "safe-read.h"
 #include "system.h"
 #include "xbinary-io.h"
+#include "xdectoint.h"
+#include "xvasprintf.h"
 
 /* The official name of this program (e.g., no 'g' prefix).  */
 #define PROGRAM_NAME "my_cat"
@@ -33,31 +67,100 @@ static char const *infile;//入力ファイル名を指定するために定義
 /* Descriptor on which input file is open.  */
 static int input_desc;//ファイルディスクリプタを保持するために定義
 
-/* Buffer for line numbers.
-   An 11 digit counter may overflow within an hour on a P2/466,
-   an 18 digit counter needs about 1000y */
-#define LINE_COUNTER_BUF_LEN 20
-static char line_buf[LINE_COUNTER_BUF_LEN] =
-    {
-        ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ',
-        ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', '0',
-        '\t', '\0'};//行数を管理するため
-
-/* line_bufの中で印刷を開始する位置を指定します。これは、行数が999999より大きくなければ変化しない。 */
-// この`line_buf`は、行番号を表示するためのバッファです。初期状態では、バッファは空白文字（' '）で埋められ、最後にタブ文字（'\t'）とヌル文字（'\0'）が追加されています。これにより、行番号を表示する際には、前方が空白で、後方がタブで区切られたフォーマットになります。バッファのサイズ（`LINE_COUNTER_BUF_LEN`）は、必要な行番号の最大桁数（おそらく最大で7桁）に余裕を持たせて設定されていると思われます。
-
-// `line_num_print`は`line_buf`内で印刷開始位置を指示するポインタで、初期値は`line_buf + LINE_COUNTER_BUF_LEN - 8`となっています。これはバッファの末尾から8文字前を指しています。このポインタ位置から行番号が表示され、行番号が1000000（7桁）以上になると、印刷開始位置は左に移動して行きます。
-
-// したがって、このバッファとポインタは、行番号を整形して表示するためのもので、行番号の前に適切な数の空白を置くことで、行番号の表示を右揃えに保つために使われています。
-static char *line_num_print = line_buf + LINE_COUNTER_BUF_LEN - 8;//12
-
-/* 'line_buf'の1桁目の位置。 */
-static char *line_num_start = line_buf + LINE_COUNTER_BUF_LEN - 3;//17
-
-/* 'line_buf'の最後の桁の位置。 */
-static char *line_num_end = line_buf + LINE_COUNTER_BUF_LEN - 3;//17
-
-static int newlines2 = 0;/* 'cat'関数のローカルな'改行'を呼び出しの間に保持する。 */
+/* 標準出力へ整形するときの状態。 行番号と改行の数はファイルをまたいで引き継ぐ。 */
+static struct cat_ctx stdout_ctx;
+
+/* 入力の読み方。 */
+enum io_engine {
+    IO_ENGINE_AUTO,    /* ファイルの種類から選ぶ */
+    IO_ENGINE_READ,    /* read/write のループだけを使う */
+    IO_ENGINE_MMAP,    /* 通常ファイルを mmap して整形する */
+    IO_ENGINE_IO_URING /* io_uring で次のブロックを先読みする */
+};
+
+static char const *const io_engine_args[] = {
+    "auto", "read", "mmap", "io_uring", NULL};
+static enum io_engine const io_engine_types[] = {
+    IO_ENGINE_AUTO, IO_ENGINE_READ, IO_ENGINE_MMAP, IO_ENGINE_IO_URING};
+ARGMATCH_VERIFY(io_engine_args, io_engine_types);
+
+static enum io_engine io_engine = IO_ENGINE_AUTO;
+
+/* 短い名前を持たない長いオプション。 */
+enum {
+    IO_ENGINE_OPTION = CHAR_MAX + 1,
+    PARALLEL_OPTION,
+    RING_DEPTH_OPTION,
+    WRITEV_OPTION,
+    PREFETCH_OPTION,
+    HUGE_PAGES_OPTION,
+    ADAPTIVE_IO_OPTION,
+    DIRECT_OPTION,
+    NOCACHE_OPTION,
+    STATS_OPTION,
+    PERF_COUNTERS_OPTION,
+    NUMBER_WIDTH_OPTION,
+    NUMBER_START_OPTION,
+    NUMBER_INCREMENT_OPTION,
+    NUMBER_SEPARATOR_OPTION,
+    MICROBENCH_OPTION,
+    FUZZ_OPTION
+};
+
+/* 通常ファイルを mmap で読むときの窓の大きさ。ページサイズの倍数。 */
+enum { MMAP_WINDOW = 32 * 1024 * 1024 };
+
+/* 通常ファイルの入力を mmap の窓から直接 cat() に渡すための状態。
+   cat() はブロックの末尾に番兵の改行を必要とするが、マッピングには
+   書き込めないので、ブロックの中の最後の改行を番兵として使う。その改行は
+   次のブロックの先頭として読み直され、本物の改行として処理される。
+   改行が見つからない長い行だけは inbuf にコピーする。
+   マッピング中にファイルが切り詰められると SIGBUS になる。 */
+static struct {
+    bool active;   /* mmap で読んでいる */
+    char *base;    /* 現在の窓の先頭。なければ NULL */
+    size_t len;    /* 現在の窓の長さ */
+    off_t map_off; /* 窓の先頭のファイル上の位置 */
+    off_t pos;     /* 次に渡すバイトのファイル上の位置 */
+    off_t size;    /* 開始時のファイルサイズ */
+} mmap_in;
+
+/* ファイルをまたいで使い回す、境界を揃えたバッファ。 必要な大きさが
+   増えたときだけ取り直すので、ファイルごとに確保と解放を繰り返さない。 */
+struct io_buffer {
+    char *alloc;    /* xmalloc した先頭 */
+    char *buf;      /* 境界に揃えた先頭 */
+    size_t size;    /* BUF から使える大きさ */
+};
+
+static struct io_buffer in_buffer;
+static struct io_buffer out_buffer;
+
+/* --huge-pages のときにバッファを揃える境界。 */
+enum { HUGE_PAGE_SIZE = 2 * 1024 * 1024 };
+
+/* --huge-pages: バッファを透過的ヒュージページで確保するよう頼む。 */
+static bool huge_pages;
+
+/* B から、PAGE_SIZE の境界に揃えた SIZE バイト以上のバッファを返す。
+   --huge-pages なら HUGE_PAGE_SIZE の倍数にして、その境界に揃える。 */
+static char *
+io_buffer_get(struct io_buffer *b, size_t size, size_t page_size) {
+    if (b->size < size) {
+        size_t align = huge_pages ? HUGE_PAGE_SIZE : page_size;
+        if (huge_pages)
+            size = (size + align - 1) / align * align;
+        free(b->alloc);
+        b->alloc = xmalloc(size + align - 1);
+        b->buf = ptr_align(b->alloc, align);
+        b->size = size;
+#ifdef MADV_HUGEPAGE
+        if (huge_pages)
+            madvise(b->buf, size, MADV_HUGEPAGE);
+#endif
+    }
+    return b->buf;
+}
 
 void usage(int status) {
     if (status != EXIT_SUCCESS)
@@ -84,6 +187,45 @@ Usage: %s [OPTION]... [FILE]...\n"),
   -T, --show-tabs          display TAB characters as ^I\n\
   -u                       (ignored)\n\
   -v, --show-nonprinting   use ^ and M- notation, except for LFD and TAB\n\
+"),
+              stdout);
+        fputs(_("\
+      --number-width=N     use at least N columns for line numbers (default 6)\n\
+      --number-start=N     first line number (default 1)\n\
+      --number-increment=N line number increment (default 1)\n\
+      --number-separator=STRING  add STRING after line numbers (default TAB)\n\
+"),
+              stdout);
+        fputs(_("\
+      --io-engine=ENGINE   read input with ENGINE: auto (default), read,\n\
+                             mmap or io_uring; mmap is killed by SIGBUS if\n\
+                             a file is truncated while it is being read;\n\
+                             io_uring reads small files in batches, before\n\
+                             the files ahead of them are written\n\
+      --parallel[=N]       format with N threads (default: the number of\n\
+                             processors)\n\
+      --ring-depth=N       read ahead up to N blocks in a separate thread\n\
+      --writev             write unchanged input directly with writev,\n\
+                             not through the output buffer\n\
+      --prefetch=N         open up to N following files ahead and ask the\n\
+                             kernel to read them ahead (default 0: each\n\
+                             file is opened when its turn comes)\n\
+      --huge-pages         back the I/O buffers with transparent huge pages\n\
+      --adaptive-io[=MIN:MAX]  choose the read size by measuring throughput\n\
+                             on the start of each file, between MIN and MAX\n\
+                             bytes (default 16K:4M); implies --io-engine=read;\n\
+                             --stats reports the size chosen for each file\n\
+      --direct             read regular files with O_DIRECT, bypassing the\n\
+                             page cache; implies --io-engine=read\n\
+      --nocache            drop input and regular-file output from the page\n\
+                             cache once they are done with; implies\n\
+                             --io-engine=read\n\
+      --stats[=FORMAT]     report I/O statistics per input and in total on\n\
+                             standard error; FORMAT is 'text' or 'json';\n\
+                             with --parallel, formatting time is summed\n\
+                             over the threads\n\
+      --perf-counters      report CPU counters for the refill, format and\n\
+                             flush phases on standard error\n\
 "),
               stdout);
         fputs(HELP_OPTION_DESCRIPTION, stdout);
@@ -99,48 +241,1097 @@ Examples:\n\
     exit(status);
 }
 
-/* 行番号を文字列で作り上げる  */
-// もちろんです、それぞれの行とそのポインタ操作について説明します。
+#if USE_IO_URING
+/* io_uring で同時に発行しておく読み込みの数。 */
+enum { URING_DEPTH = 4 };
+
+/* io_uring_setup でマップしたリング。 liburing は使わず、必要な
+   最小限だけを直接システムコールで扱う。 */
+struct uring {
+    int fd;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_len, cq_ring_len, sqes_len;
+    unsigned to_submit; /* 追加したがまだ io_uring_enter していない数 */
+};
+
+/* ENTRIES 個の要素を持つリングを作る。カーネルが io_uring に対応して
+   いなければ false。 */
+static bool
+uring_init(struct uring *r, unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof p);
+    r->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0)
+        return false;
+
+    r->sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_ring_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        r->sq_ring_len = r->cq_ring_len = MAX(r->sq_ring_len, r->cq_ring_len);
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    r->sq_ring = mmap(NULL, r->sq_ring_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ring == MAP_FAILED)
+        goto fail_fd;
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        r->cq_ring = r->sq_ring;
+    else {
+        r->cq_ring = mmap(NULL, r->cq_ring_len, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_ring == MAP_FAILED)
+            goto fail_sq;
+    }
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED)
+        goto fail_cq;
+
+    r->sq_tail = (unsigned *)((char *)r->sq_ring + p.sq_off.tail);
+    r->sq_mask = (unsigned *)((char *)r->sq_ring + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)((char *)r->sq_ring + p.sq_off.array);
+    r->cq_head = (unsigned *)((char *)r->cq_ring + p.cq_off.head);
+    r->cq_tail = (unsigned *)((char *)r->cq_ring + p.cq_off.tail);
+    r->cq_mask = (unsigned *)((char *)r->cq_ring + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)((char *)r->cq_ring + p.cq_off.cqes);
+    r->to_submit = 0;
+    return true;
+
+fail_cq:
+    if (r->cq_ring != r->sq_ring)
+        munmap(r->cq_ring, r->cq_ring_len);
+fail_sq:
+    munmap(r->sq_ring, r->sq_ring_len);
+fail_fd:
+    close(r->fd);
+    return false;
+}
 
-// 1. `char *endp = line_num_end;`
-//    ここでは、`endp`という新しいポインタを作成し、それを`line_num_end`が指す場所に初期化しています。`line_num_end`は行番号の最後の桁を指すので、ここでは行番号の最後の桁について操作を行います。
+/* 次の SQE を取り出して0で埋める。呼び出し側は発行中の数がリングの
+   大きさを超えないようにする。 */
+static struct io_uring_sqe *
+uring_get_sqe(struct uring *r) {
+    unsigned tail = *r->sq_tail + r->to_submit;
+    unsigned idx = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    r->sq_array[idx] = idx;
+    r->to_submit++;
+    memset(sqe, 0, sizeof *sqe);
+    return sqe;
+}
 
-// 2. `do {`
-//    ここでは`do-while`ループを開始しています。このループは、各桁についてチェックし、必要に応じて桁上げを行います。
+/* 追加した SQE を発行し、少なくとも WAIT_NR 個の完了を待つ。 */
+static int
+uring_enter(struct uring *r, unsigned wait_nr) {
+    unsigned n = r->to_submit;
+    __atomic_store_n(r->sq_tail, *r->sq_tail + n, __ATOMIC_RELEASE);
+    r->to_submit = 0;
+    while (true) {
+        int ret = syscall(__NR_io_uring_enter, r->fd, n, wait_nr,
+                          wait_nr ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (0 <= ret || errno != EINTR)
+            return ret;
+        n = 0;
+    }
+}
 
-// 3. `if ((*endp)++ < '9')`
-//    ここでは`endp`が指す文字をインクリメントしています。そして、そのインクリメントした値が`'9'`より小さいかどうかをチェックしています。もし`'9'`より小さい場合、その桁でのキャリーオーバーは不要であるため、ループから抜け出します。
+/* 完了した CQE を1つ取り出す。なければ NULL。 */
+static struct io_uring_cqe *
+uring_peek_cqe(struct uring *r) {
+    unsigned head = *r->cq_head;
+    if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &r->cqes[head & *r->cq_mask];
+}
 
-// 4. `*endp-- = '0';`
-//    もし`endp`が指す文字が`'9'`だった場合（つまり、その桁でキャリーオーバーが必要な場合）、その桁を`'0'`にリセットし、左の桁（`endp`の1つ前）に移動します。
+/* uring_peek_cqe で取り出した CQE を返却する。 */
+static void
+uring_cqe_seen(struct uring *r) {
+    __atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+}
 
-// 5. `} while (endp >= line_num_start);`
-//    ここで`do-while`ループが終了します。`endp`が`line_num_start`以上である限り、ループは続きます。これは、行番号の左端に達するまでキャリーオーバーを続けるためです。
+/* 通常ファイルを io_uring で先読みするための状態。 URING_DEPTH 個の
+   バッファを登録しておき、cat() や simple_cat() が1つのバッファを
+   処理している間に、残りのバッファへの読み込みを発行しておく。
+   各バッファには cat() の番兵のために1バイト余分に確保する。 */
+static struct {
+    bool active;       /* io_uring で読んでいる */
+    bool ring_ok;      /* RING を作れた */
+    bool ring_failed;  /* io_uring が使えないとわかった */
+    bool fixed;        /* バッファを登録できた */
+    struct uring ring;
+    char *bufs;        /* URING_DEPTH 個のバッファ。 */
+    char *bufs_alloc;  /* BUFS の xmalloc した先頭 */
+    size_t bufsize;    /* 1回の読み込みの大きさ */
+    size_t stride;     /* バッファの間隔 */
+    struct {
+        off_t off;     /* 読み込んでいる位置 */
+        bool inflight; /* 完了を待っている */
+        int res;       /* 完了したときの結果 */
+    } slot[URING_DEPTH];
+    unsigned head;     /* 次に渡すバッファ */
+    int last;          /* 最後に渡したバッファ。なければ -1 */
+    off_t submit_off;  /* 次に発行する読み込みの位置 */
+    off_t read_off;    /* 次に渡すバイトの位置 */
+    bool restart;      /* 短い読み込みがあったので発行し直す */
+    bool eof;
+} uring_in;
+
+/* スロット I への読み込みを OFF から発行する。 */
+static void
+uring_input_queue(unsigned i, off_t off) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&uring_in.ring);
+    sqe->opcode = uring_in.fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->fd = input_desc;
+    sqe->off = off;
+    sqe->addr = (uintptr_t)(uring_in.bufs + i * uring_in.stride);
+    sqe->len = uring_in.bufsize;
+    sqe->buf_index = i;
+    sqe->user_data = i;
+    uring_in.slot[i].off = off;
+    uring_in.slot[i].inflight = true;
+}
 
-// 6. `if (line_num_start > line_buf)`
-//    ここでは、行番号の左端`line_num_start`が全体のバッファ`line_buf`を越えていないかを確認しています。越えていない場合、次の行で行番号の左端を1つ左に移動します。
+/* 完了した読み込みをスロットに記録する。 WAIT なら少なくとも1つ待つ。 */
+static bool
+uring_input_reap(bool wait) {
+    struct io_uring_cqe *cqe;
+    if ((wait || uring_in.ring.to_submit)
+        && uring_enter(&uring_in.ring, wait ? 1 : 0) < 0)
+        return false;
+    while ((cqe = uring_peek_cqe(&uring_in.ring))) {
+        unsigned i = cqe->user_data;
+        uring_in.slot[i].res = cqe->res;
+        uring_in.slot[i].inflight = false;
+        uring_cqe_seen(&uring_in.ring);
+    }
+    return true;
+}
 
-// 7. `*--line_num_start = '1';`
-//    ここでは、行番号の左端`line_num_start`を1つ左に移動し、その新しい位置に`'1'`を設定します。これは、すべての桁がキャリーオーバーした場合（例えば`'999'`から`'1000'`になる場合）に行われます。
+/* 発行中の読み込みがすべて終わるのを待つ。 */
+static void
+uring_input_drain(void) {
+    while (true) {
+        unsigned i;
+        for (i = 0; i < URING_DEPTH; i++)
+            if (uring_in.slot[i].inflight)
+                break;
+        if (i == URING_DEPTH || !uring_input_reap(true))
+            return;
+    }
+}
 
-// 8. `else *line_buf = '>';`
-//    もし`line_num_start`が`line_buf`を越えてしまった場合（つまり、行番号がバッファの大きさを超えてしまった場合）、バッファの最初の位置に`'>'`を設定します。これは、行番号がバッ
+/* READ_OFF からすべてのスロットに読み込みを発行し直す。 */
 static void
-next_line_num(void) {
-    char *endp = line_num_end;
+uring_input_submit_all(void) {
+    uring_in.submit_off = uring_in.read_off;
+    uring_in.head = 0;
+    uring_in.last = -1;
+    for (unsigned i = 0; i < URING_DEPTH; i++) {
+        uring_input_queue(i, uring_in.submit_off);
+        uring_in.submit_off += uring_in.bufsize;
+    }
+}
+
+/* INPUT_DESC の現在位置から、BUFSIZE ずつの先読みを始める。
+   io_uring が使えなければ false を返し、呼び出し側は read で読む。 */
+static bool
+uring_input_start(size_t bufsize) {
+    size_t page_size = getpagesize();
+    off_t pos;
+
+    if (uring_in.ring_failed)
+        return false;
+    if (!uring_in.ring_ok) {
+        if (!uring_init(&uring_in.ring, URING_DEPTH)) {
+            uring_in.ring_failed = true;
+            return false;
+        }
+        uring_in.ring_ok = true;
+    }
+    pos = lseek(input_desc, 0, SEEK_CUR);
+    if (pos < 0)
+        return false;
+
+    /* バッファはファイルをまたいで使い回し、足りないときだけ作り直す。 */
+    if (uring_in.bufsize < bufsize) {
+        if (uring_in.fixed)
+            syscall(__NR_io_uring_register, uring_in.ring.fd,
+                    IORING_UNREGISTER_BUFFERS, NULL, 0);
+        free(uring_in.bufs_alloc);
+        uring_in.stride = (bufsize + 1 + page_size - 1) / page_size * page_size;
+        uring_in.bufs_alloc = xmalloc(URING_DEPTH * uring_in.stride + page_size - 1);
+        uring_in.bufs = ptr_align(uring_in.bufs_alloc, page_size);
+
+        /* 登録できなければ（RLIMIT_MEMLOCK など）普通の READ を使う。 */
+        {
+            struct iovec iov[URING_DEPTH];
+            for (unsigned i = 0; i < URING_DEPTH; i++) {
+                iov[i].iov_base = uring_in.bufs + i * uring_in.stride;
+                iov[i].iov_len = uring_in.stride;
+            }
+            uring_in.fixed = syscall(__NR_io_uring_register, uring_in.ring.fd,
+                                     IORING_REGISTER_BUFFERS, iov,
+                                     URING_DEPTH) == 0;
+        }
+    }
+    uring_in.bufsize = bufsize;
+    uring_in.read_off = pos;
+    uring_in.restart = false;
+    uring_in.eof = false;
+    uring_input_submit_all();
+    if (uring_enter(&uring_in.ring, 0) < 0) {
+        uring_in.ring_failed = true;
+        for (unsigned i = 0; i < URING_DEPTH; i++)
+            uring_in.slot[i].inflight = false;
+        return false;
+    }
+    uring_in.active = true;
+    return true;
+}
+
+/* 先読みをやめ、ファイルオフセットを次に渡すバイトに合わせる。 */
+static void
+uring_input_end(void) {
+    if (!uring_in.active)
+        return;
+    uring_input_drain();
+    uring_in.active = false;
+    lseek(input_desc, uring_in.read_off, SEEK_SET);
+}
+
+/* 次のブロックを *BLOCKP に入れて長さを返す。直前に渡したバッファは
+   もう使われないので、ここで次の読み込みに回す。 */
+static size_t
+uring_input_read(char **blockp) {
+    unsigned i;
+    int res;
+
+    if (uring_in.eof)
+        return 0;
+    if (uring_in.restart) {
+        /* 短い読み込みのあとは、発行済みの読み込みの位置がずれている。 */
+        uring_input_drain();
+        uring_input_submit_all();
+        uring_in.restart = false;
+    } else if (0 <= uring_in.last) {
+        uring_input_queue(uring_in.last, uring_in.submit_off);
+        uring_in.submit_off += uring_in.bufsize;
+    }
+
+    i = uring_in.head;
     do {
-        if ((*endp)++ < '9')
-            return;
-        *endp-- = '0';
-    } while (endp >= line_num_start);
-    if (line_num_start > line_buf)
-        *--line_num_start = '1';
-    else
-        *line_buf = '>';
-    if (line_num_start < line_num_print)
-        line_num_print--;
+        if (!uring_input_reap(uring_in.slot[i].inflight))
+            return SAFE_READ_ERROR;
+        if (!uring_in.slot[i].inflight && (uring_in.slot[i].res == -EINTR
+                                           || uring_in.slot[i].res == -EAGAIN))
+            uring_input_queue(i, uring_in.slot[i].off);
+    } while (uring_in.slot[i].inflight);
+
+    res = uring_in.slot[i].res;
+    if (res < 0) {
+        errno = -res;
+        return SAFE_READ_ERROR;
+    }
+    if (res == 0) {
+        uring_in.eof = true;
+        return 0;
+    }
+    if ((size_t)res < uring_in.bufsize)
+        uring_in.restart = true;
+    *blockp = uring_in.bufs + i * uring_in.stride;
+    uring_in.read_off += res;
+    uring_in.head = (i + 1) % URING_DEPTH;
+    uring_in.last = i;
+    return res;
+}
+#else
+static struct {
+    bool active;
+} uring_in;
+
+static bool
+uring_input_start(size_t bufsize) {
+    return false;
+}
+
+static void
+uring_input_end(void) {
+}
+#endif
+
+/* --ring-depth で、別のスレッドが読んでおくブロックの数の上限。 */
+enum { RING_DEPTH_MAX = 1024 };
+
+/* --ring-depth のブロックの数。 0 なら読むスレッドを使わない。 */
+static size_t ring_depth;
+
+/* 読むスレッドと、整形して書き出すスレッドの間でブロックを渡す輪。
+   読む側だけが head を、書く側だけが tail を進めるので、ロックは要らない。
+   待つときだけ futex で眠り、相手が眠っているときだけ起こす。 */
+static struct {
+    bool active;
+    char *bufs;                 /* depth 個の、ページ境界に揃えたバッファ */
+    char *bufs_alloc;
+    size_t bufsize;
+    size_t stride;              /* バッファの間隔。 番兵の1バイトを含む */
+    size_t depth;
+    size_t *lens;               /* 読んだ長さ。 safe_read の戻り値 */
+    int *errs;                  /* 読み込みのエラー */
+    atomic_uint head;           /* 読み終えたブロックの数 */
+    atomic_uint tail;           /* 使い終えたブロックの数 */
+    atomic_bool reader_waiting; /* 読む側が tail の変化を待っている */
+    atomic_bool writer_waiting; /* 書く側が head の変化を待っている */
+    bool holding;               /* 書く側が tail 番目のブロックを使っている */
+    bool done;                  /* 読む側が EOF かエラーで止まった */
+    pthread_t tid;
+} ring_in;
+
+/* *WORD が VAL のあいだ眠る。 */
+static void
+ring_wait(atomic_uint *word, unsigned int val) {
+#ifdef __linux__
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+#else
+    sched_yield();
+#endif
+}
+
+/* *WORD で眠っているスレッドを起こす。 */
+static void
+ring_wake(atomic_uint *word) {
+#ifdef __linux__
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#endif
+}
+
+/* INPUT_DESC を読んで、ブロックを順に輪に入れる。 */
+static void *
+ring_reader(void *arg) {
+    (void) arg;
+    unsigned int head = atomic_load_explicit(&ring_in.head,
+                                             memory_order_relaxed);
+    while (true) {
+        unsigned int tail;
+        while (head - (tail = atomic_load(&ring_in.tail)) == ring_in.depth) {
+            atomic_store(&ring_in.reader_waiting, true);
+            if (head - atomic_load(&ring_in.tail) == ring_in.depth)
+                ring_wait(&ring_in.tail, tail);
+            atomic_store(&ring_in.reader_waiting, false);
+        }
+
+        size_t i = head % ring_in.depth;
+        size_t n_read = safe_read(input_desc, ring_in.bufs + i * ring_in.stride,
+                                  ring_in.bufsize);
+        ring_in.lens[i] = n_read;
+        ring_in.errs[i] = n_read == SAFE_READ_ERROR ? errno : 0;
+        atomic_store_explicit(&ring_in.head, ++head, memory_order_release);
+        if (atomic_load(&ring_in.writer_waiting))
+            ring_wake(&ring_in.head);
+
+        if (n_read == 0 || n_read == SAFE_READ_ERROR)
+            return NULL;
+    }
+}
+
+/* 読むスレッドを作り、RING_DEPTH 個の BUFSIZE バイトのバッファで
+   先読みを始める。 スレッドを作れなければ false を返す。 */
+static bool
+ring_input_start(size_t bufsize) {
+    size_t page_size = getpagesize();
+
+    ring_in.bufsize = bufsize;
+    ring_in.stride = (bufsize + 1 + page_size - 1) / page_size * page_size;
+    ring_in.depth = ring_depth;
+    ring_in.bufs_alloc = xmalloc(ring_in.depth * ring_in.stride
+                                 + page_size - 1);
+    ring_in.bufs = ptr_align(ring_in.bufs_alloc, page_size);
+    ring_in.lens = xnmalloc(ring_in.depth, sizeof *ring_in.lens);
+    ring_in.errs = xnmalloc(ring_in.depth, sizeof *ring_in.errs);
+    atomic_init(&ring_in.head, 0);
+    atomic_init(&ring_in.tail, 0);
+    atomic_init(&ring_in.reader_waiting, false);
+    atomic_init(&ring_in.writer_waiting, false);
+    ring_in.holding = false;
+    ring_in.done = false;
+
+    if (pthread_create(&ring_in.tid, NULL, ring_reader, NULL) != 0) {
+        free(ring_in.bufs_alloc);
+        free(ring_in.lens);
+        free(ring_in.errs);
+        return false;
+    }
+    ring_in.active = true;
+    return true;
+}
+
+/* 読み終えたブロックがあれば true を返す。 */
+static bool
+ring_input_pending(void) {
+    unsigned int tail = atomic_load_explicit(&ring_in.tail,
+                                             memory_order_relaxed);
+    return (atomic_load_explicit(&ring_in.head, memory_order_acquire)
+            - tail) > ring_in.holding;
+}
+
+/* 前に渡したブロックを返し、次のブロックを *BLOCKP に入れて長さを返す。
+   ブロックには番兵のための1バイトがある。 戻り値は safe_read と同じ。 */
+static size_t
+ring_input_read(char **blockp) {
+    unsigned int tail = atomic_load_explicit(&ring_in.tail,
+                                             memory_order_relaxed);
+    if (ring_in.holding) {
+        ring_in.holding = false;
+        atomic_store(&ring_in.tail, ++tail);
+        if (atomic_load(&ring_in.reader_waiting))
+            ring_wake(&ring_in.tail);
+    }
+    if (ring_in.done)
+        return 0;
+
+    unsigned int head;
+    while ((head = atomic_load_explicit(&ring_in.head, memory_order_acquire))
+           == tail) {
+        atomic_store(&ring_in.writer_waiting, true);
+        if (atomic_load(&ring_in.head) == tail)
+            ring_wait(&ring_in.head, tail);
+        atomic_store(&ring_in.writer_waiting, false);
+    }
+
+    size_t i = tail % ring_in.depth;
+    size_t n_read = ring_in.lens[i];
+    ring_in.holding = true;
+    if (n_read == 0 || n_read == SAFE_READ_ERROR) {
+        ring_in.done = true;
+        errno = ring_in.errs[i];
+    }
+    *blockp = ring_in.bufs + i * ring_in.stride;
+    return n_read;
+}
+
+/* 読むスレッドを待って、バッファを解放する。 cat() と simple_cat() は
+   EOF かエラーを受け取るまで戻らないので、読むスレッドはもう止まっている。 */
+static void
+ring_input_end(void) {
+    if (!ring_in.active)
+        return;
+    pthread_join(ring_in.tid, NULL);
+    free(ring_in.bufs_alloc);
+    free(ring_in.lens);
+    free(ring_in.errs);
+    ring_in.active = false;
+}
+
+/* --direct: 通常ファイルの入力を O_DIRECT で読み、ページキャッシュを
+   通さない。 */
+static bool direct_io;
+
+/* 今の入力を O_DIRECT で読んでいるか。 ALIGN は読み込みの大きさと
+   位置、バッファを揃える境界。 */
+static struct {
+    bool active;
+    size_t align;
+} direct_in;
+
+/* INPUT_DESC に O_DIRECT を付ける。 読む位置が ALIGN に揃っていないか、
+   ファイルシステムが断れば、普通の read のままにする。 */
+static void
+direct_input_start(size_t align) {
+    int flags = fcntl(input_desc, F_GETFL);
+    off_t pos = lseek(input_desc, 0, SEEK_CUR);
+    direct_in.align = align;
+    direct_in.active = (0 <= flags && 0 <= pos && pos % align == 0
+                        && fcntl(input_desc, F_SETFL, flags | O_DIRECT) == 0);
+}
+
+/* O_DIRECT を外す。 標準入力のファイル記述は他のプロセスとも共有して
+   いるので、元に戻しておく。 */
+static void
+direct_input_end(void) {
+    if (direct_in.active) {
+        int flags = fcntl(input_desc, F_GETFL);
+        if (0 <= flags)
+            fcntl(input_desc, F_SETFL, flags & ~O_DIRECT);
+        direct_in.active = false;
+    }
+}
+
+/* INPUT_DESC から BUF に SIZE バイトまで読む。 BUF は境界に揃っている
+   こと。 O_DIRECT では大きさを境界に切り下げて読む。 ファイルの末尾の
+   端数を読むと位置が揃わなくなるので、その後は普通の read に戻る。
+   ファイルシステムが EINVAL で断ったときも同じ。 */
+static size_t
+direct_read(char *buf, size_t size) {
+    if (direct_in.active) {
+        size_t n = size / direct_in.align * direct_in.align;
+        if (n != 0) {
+            size_t n_read = safe_read(input_desc, buf, n);
+            if (n_read != SAFE_READ_ERROR) {
+                if (n_read % direct_in.align != 0)
+                    direct_input_end();
+                return n_read;
+            }
+            if (errno != EINVAL)
+                return n_read;
+        }
+        direct_input_end();
+    }
+    return safe_read(input_desc, buf, size);
+}
+
+/* --adaptive-io の既定の範囲。 */
+enum { ADAPTIVE_MIN = 16 * 1024, ADAPTIVE_MAX = 4 * 1024 * 1024 };
+
+/* --adaptive-io で、1つの大きさを試すのに読む量。 */
+enum { ADAPTIVE_TRIAL = 1024 * 1024 };
+
+/* --adaptive-io: ファイルの初めの部分で、読み込みの大きさを min から
+   倍にしながら、それぞれで読み込みの間隔から速さを測る。 速さが落ちたか
+   max に届いたら、一番速かった大きさに決め、残りはその大きさで読む。
+   決めた大きさは --stats で報告する。 */
+static struct {
+    bool enabled;
+    size_t min;
+    size_t max;
+    bool probing;           /* 大きさを試している */
+    size_t size;            /* 今の読み込みの大きさ */
+    size_t best;            /* 一番速かった大きさ */
+    double best_rate;       /* その速さ。 バイト毎ナノ秒 */
+    xtime_t trial_start;
+    uintmax_t trial_bytes;
+    int trial_reads;
+    size_t chosen;          /* 今のファイルで決めた大きさ。 まだなら 0 */
+} adaptive = {
+    .min = ADAPTIVE_MIN,
+    .max = ADAPTIVE_MAX
+};
+
+/* 新しいファイルについて、大きさを試し始める。 */
+static void
+adaptive_start(void) {
+    adaptive.probing = true;
+    adaptive.size = adaptive.best = adaptive.min;
+    adaptive.best_rate = 0;
+    adaptive.trial_bytes = 0;
+    adaptive.trial_reads = 0;
+}
+
+/* NOW に終わった試しを評価し、次の大きさを試すか、大きさを決める。 */
+static void
+adaptive_next(xtime_t now) {
+    double rate = (double) adaptive.trial_bytes / MAX(1, now - adaptive.trial_start);
+
+    if (adaptive.best_rate < rate) {
+        adaptive.best_rate = rate;
+        adaptive.best = adaptive.size;
+    }
+    if (rate < adaptive.best_rate * 0.9 || adaptive.max <= adaptive.size) {
+        adaptive.probing = false;
+        adaptive.size = adaptive.chosen = adaptive.best;
+        return;
+    }
+
+    adaptive.size = MIN(adaptive.size * 2, adaptive.max);
+    adaptive.trial_start = now;
+    adaptive.trial_bytes = 0;
+    adaptive.trial_reads = 0;
+}
+
+/* 今の大きさで、BUFSIZE を超えないように BUF に読む。 */
+static size_t
+adaptive_read(char *buf, size_t bufsize) {
+    if (adaptive.probing) {
+        xtime_t now = gethrxtime();
+        if (adaptive.trial_reads == 0)
+            adaptive.trial_start = now;
+        else if (2 <= adaptive.trial_reads
+                 && ADAPTIVE_TRIAL <= adaptive.trial_bytes)
+            adaptive_next(now);
+    }
+
+    size_t n_read = direct_read(buf, MIN(adaptive.size, bufsize));
+    if (adaptive.probing && n_read != SAFE_READ_ERROR) {
+        adaptive.trial_bytes += n_read;
+        adaptive.trial_reads++;
+    }
+    return n_read;
+}
+
+/* INPUT_DESC から次のブロックを読み、その先頭を *BLOCKP に入れて長さを
+   返す。 io_uring や読むスレッドで先読みしているときは先読み用の
+   バッファを、そうでなければ BUF を指す。先読み用のバッファには番兵の
+   ための1バイトがあり、BUF の分は呼び出し側が確保する。戻り値は
+   safe_read と同じ。 */
+static size_t
+read_input(char *buf, size_t bufsize, char **blockp) {
+    if (ring_in.active)
+        return ring_input_read(blockp);
+#if USE_IO_URING
+    if (uring_in.active)
+        return uring_input_read(blockp);
+#endif
+    *blockp = buf;
+    if (adaptive.enabled)
+        return adaptive_read(buf, bufsize);
+    return direct_read(buf, bufsize);
+}
+
+/* --nocache: 読み終えた入力と書き終えた出力をページキャッシュから
+   落とし、大きなファイルを流してもメモリを圧迫しないようにする。 */
+static bool nocache;
+
+/* --nocache で、キャッシュから落とす単位。 */
+enum { NOCACHE_CHUNK = 8 * 1024 * 1024 };
+
+/* 通常ファイルの入力の、読んだ位置と落とした位置。 */
+static struct {
+    bool active;
+    off_t pos;
+    off_t dropped;
+} nocache_in;
+
+/* 通常ファイルへの出力の、書き戻しを始めた位置と落とした位置。
+   PENDING は最後に書き戻しを始めてから書いたバイト数。 */
+static struct {
+    bool active;
+    off_t flushed;
+    off_t dropped;
+    size_t pending;
+} nocache_out;
+
+/* INPUT_DESC の今の位置から、読んだ分を落とし始める。 */
+static void
+nocache_input_start(void) {
+    nocache_in.pos = lseek(input_desc, 0, SEEK_CUR);
+    nocache_in.dropped = nocache_in.pos - nocache_in.pos % getpagesize();
+    nocache_in.active = 0 <= nocache_in.pos;
+}
+
+/* 入力から N バイト読んだ。 読み終えたページがたまったら落とす。
+   DONTNEED はページ全体にしか効かないので、ページ境界までにする。 */
+static void
+nocache_input(size_t n) {
+    if (!nocache_in.active)
+        return;
+    nocache_in.pos += n;
+    if (nocache_in.pos - nocache_in.dropped < NOCACHE_CHUNK)
+        return;
+    off_t end = nocache_in.pos - nocache_in.pos % getpagesize();
+    fdadvise(input_desc, nocache_in.dropped, end - nocache_in.dropped,
+             FADVISE_DONTNEED);
+    nocache_in.dropped = end;
+}
+
+/* 入力の残りを落とす。 */
+static void
+nocache_input_end(void) {
+    if (nocache_in.active) {
+        fdadvise(input_desc, nocache_in.dropped, 0, FADVISE_DONTNEED);
+        nocache_in.active = false;
+    }
+}
+
+/* 標準出力の今の位置から、書いた分を落とし始める。 書き戻しが
+   sync_file_range で制御できなければ何もしない。 */
+static void
+nocache_output_start(void) {
+#ifdef SYNC_FILE_RANGE_WRITE
+    off_t pos = lseek(STDOUT_FILENO, 0, SEEK_CUR);
+    nocache_out.flushed = nocache_out.dropped = pos;
+    nocache_out.pending = 0;
+    nocache_out.active = 0 <= pos;
+#endif
+}
+
+/* 標準出力に N バイト書いた。 たまったら、前に書き戻しを始めた範囲の
+   完了を待って落とし、新しく書いた範囲の書き戻しを始める。 汚れた
+   ページは高々2単位しか残らない。 */
+static void
+nocache_output(size_t n) {
+#ifdef SYNC_FILE_RANGE_WRITE
+    if (!nocache_out.active)
+        return;
+    nocache_out.pending += n;
+    if (nocache_out.pending < NOCACHE_CHUNK)
+        return;
+    nocache_out.pending = 0;
+
+    /* O_APPEND でも、位置は最後に書いたところの後ろになる。 */
+    off_t end = lseek(STDOUT_FILENO, 0, SEEK_CUR);
+    if (end < 0) {
+        nocache_out.active = false;
+        return;
+    }
+    if (nocache_out.dropped < nocache_out.flushed) {
+        off_t start = nocache_out.dropped - nocache_out.dropped % getpagesize();
+        sync_file_range(STDOUT_FILENO, start, nocache_out.flushed - start,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE
+                        | SYNC_FILE_RANGE_WAIT_AFTER);
+        fdadvise(STDOUT_FILENO, start, nocache_out.flushed - start,
+                 FADVISE_DONTNEED);
+        nocache_out.dropped = nocache_out.flushed;
+    }
+    if (nocache_out.flushed < end)
+        sync_file_range(STDOUT_FILENO, nocache_out.flushed,
+                        end - nocache_out.flushed, SYNC_FILE_RANGE_WRITE);
+    nocache_out.flushed = end;
+#endif
+}
+
+/* --stats: 入力ごとと全体の I/O の統計を、標準エラーに出す。 */
+enum stats_mode {
+    STATS_NONE,
+    STATS_TEXT,
+    STATS_JSON
+};
+
+static char const *const stats_args[] = {
+    "text", "json", NULL};
+static enum stats_mode const stats_types[] = {
+    STATS_TEXT, STATS_JSON};
+ARGMATCH_VERIFY(stats_args, stats_types);
+
+static enum stats_mode stats_mode = STATS_NONE;
+
+/* 読み込みの大きさの分布は、大きさのビット数で分ける。 0 番目は EOF。 */
+enum { STATS_BUCKETS = CHAR_BIT * sizeof(size_t) + 1 };
+
+struct io_stats {
+    uintmax_t bytes_in;
+    uintmax_t bytes_out;
+    uintmax_t reads;
+    uintmax_t writes;
+    uintmax_t read_sizes[STATS_BUCKETS];
+    xtime_t read_time;    /* 読み込みで待った時間 */
+    xtime_t write_time;   /* 書き込みで待った時間 */
+    xtime_t format_time;  /* cat() で整形に使った時間 */
+    uintmax_t refills;    /* cat() が入力を読み足した回数 */
+    uintmax_t pending;    /* そのうち、入力がすぐ読めた回数 */
+    size_t read_size;     /* --adaptive-io で決めた読み込みの大きさ。
+                             決めていなければ 0 */
+};
+
+/* 今の入力と、終わった入力全体の統計。 */
+static struct io_stats file_stats;
+static struct io_stats total_stats;
+
+/* --stats のときだけ時刻を取る。 */
+static inline xtime_t
+stats_clock(void) {
+    return stats_mode == STATS_NONE ? 0 : gethrxtime();
+}
+
+/* START から始めた読み込みが N_READ を返した。 */
+static void
+stats_read(size_t n_read, xtime_t start) {
+    if (stats_mode == STATS_NONE)
+        return;
+    file_stats.read_time += gethrxtime() - start;
+    file_stats.reads++;
+    if (n_read != SAFE_READ_ERROR) {
+        int bucket = 0;
+        for (size_t n = n_read; n != 0; n >>= 1)
+            bucket++;
+        file_stats.read_sizes[bucket]++;
+        file_stats.bytes_in += n_read;
+    }
+}
+
+/* START から始めた書き込みで N_WRITTEN バイト書いた。 */
+static void
+stats_write(size_t n_written, xtime_t start) {
+    if (stats_mode == STATS_NONE)
+        return;
+    file_stats.write_time += gethrxtime() - start;
+    file_stats.writes++;
+    file_stats.bytes_out += n_written;
+}
+
+/* cat() が入力を読み足す前に、入力がすぐ読めるかを調べた。 */
+static void
+stats_refill(bool input_pending) {
+    file_stats.refills++;
+    file_stats.pending += input_pending;
+}
+
+/* START から cat() に使った時間のうち、読み書きで待った以外を整形の
+   時間とする。 IO_TIME は START での読み書きの時間の合計。 */
+static void
+stats_format(xtime_t start, xtime_t io_time) {
+    if (stats_mode == STATS_NONE)
+        return;
+    xtime_t io = file_stats.read_time + file_stats.write_time - io_time;
+    file_stats.format_time += gethrxtime() - start - io;
+}
+
+/* S を NAME の統計として出す。 NAME が NULL なら全体。 */
+static void
+stats_print(char const *name, struct io_stats const *s) {
+    double ns = 1e9;
+
+    if (stats_mode == STATS_JSON) {
+        fputs("{\"file\":", stderr);
+        if (!name)
+            fputs("null", stderr);
+        else {
+            putc('"', stderr);
+            for (unsigned char const *p = (unsigned char const *) name; *p; p++)
+                if (*p == '"' || *p == '\\')
+                    fprintf(stderr, "\\%c", *p);
+                else if (*p < ' ')
+                    fprintf(stderr, "\\u%04x", *p);
+                else
+                    putc(*p, stderr);
+            putc('"', stderr);
+        }
+        fprintf(stderr, ",\"bytes_in\":%ju,\"bytes_out\":%ju,\"reads\":%ju,"
+                "\"writes\":%ju,\"read_seconds\":%.6f,\"write_seconds\":%.6f,"
+                "\"format_seconds\":%.6f,\"refills\":%ju,"
+                "\"input_pending\":%ju,",
+                s->bytes_in, s->bytes_out, s->reads, s->writes,
+                s->read_time / ns, s->write_time / ns, s->format_time / ns,
+                s->refills, s->pending);
+        if (s->read_size)
+            fprintf(stderr, "\"read_size\":%zu,", s->read_size);
+        fputs("\"read_sizes\":{", stderr);
+        char const *sep = "";
+        for (int i = 0; i < STATS_BUCKETS; i++)
+            if (s->read_sizes[i]) {
+                fprintf(stderr, "%s\"%zu\":%ju", sep,
+                        i ? (size_t) 1 << (i - 1) : 0, s->read_sizes[i]);
+                sep = ",";
+            }
+        fputs("}}\n", stderr);
+        return;
+    }
+
+    char const *label = name ? quotef(name) : _("total");
+    error(0, 0, _("%s: %ju bytes in, %ju bytes out, %ju reads, %ju writes"),
+          label, s->bytes_in, s->bytes_out, s->reads, s->writes);
+    error(0, 0, _("%s: %.6f s reading, %.6f s writing, %.6f s formatting"),
+          label, s->read_time / ns, s->write_time / ns, s->format_time / ns);
+    if (s->refills)
+        error(0, 0, _("%s: input was pending at %ju of %ju refills"),
+              label, s->pending, s->refills);
+    if (s->read_size)
+        error(0, 0, _("%s: chose to read %zu bytes at a time"),
+              label, s->read_size);
+    for (int i = 0; i < STATS_BUCKETS; i++)
+        if (s->read_sizes[i]) {
+            size_t lo = i ? (size_t) 1 << (i - 1) : 0;
+            error(0, 0, _("%s: %ju reads of %zu to %zu bytes"), label,
+                  s->read_sizes[i], lo, i ? lo * 2 - 1 : 0);
+        }
+}
+
+/* 今の入力の統計を全体に足して、空にする。 */
+static void
+stats_add_total(void) {
+    total_stats.bytes_in += file_stats.bytes_in;
+    total_stats.bytes_out += file_stats.bytes_out;
+    total_stats.reads += file_stats.reads;
+    total_stats.writes += file_stats.writes;
+    for (int i = 0; i < STATS_BUCKETS; i++)
+        total_stats.read_sizes[i] += file_stats.read_sizes[i];
+    total_stats.read_time += file_stats.read_time;
+    total_stats.write_time += file_stats.write_time;
+    total_stats.format_time += file_stats.format_time;
+    total_stats.refills += file_stats.refills;
+    total_stats.pending += file_stats.pending;
+    memset(&file_stats, 0, sizeof file_stats);
+}
+
+/* 今の入力の統計を出して、全体に足す。 */
+static void
+stats_file_end(char const *name) {
+    file_stats.read_size = adaptive.chosen;
+    adaptive.chosen = 0;
+    if (stats_mode == STATS_NONE)
+        return;
+    stats_print(name, &file_stats);
+    stats_add_total();
+}
+
+/* 全体の統計を出す。 最後のファイルの後に書き出した分も含める。 */
+static void
+stats_end(void) {
+    if (stats_mode == STATS_NONE)
+        return;
+    stats_add_total();
+    stats_print(NULL, &total_stats);
+}
+
+/* --perf-counters: cat() の読み足し、整形、書き出しの段階ごとに、
+   このスレッドのハードウェアカウンタを数える。 */
+static bool perf_counters;
+
+enum perf_phase {
+    PERF_REFILL,
+    PERF_FORMAT,
+    PERF_FLUSH,
+    PERF_PHASES
+};
+
+#if USE_PERF_EVENTS
+static char const *const perf_phase_names[PERF_PHASES] = {
+    "refill", "format", "flush"};
+
+/* 数えるイベント。 使えないものは飛ばす。 ハードウェアカウンタが
+   ひとつもないコンテナでも、task-clock で時間だけは分かる。 */
+static struct {
+    char const *name;
+    uint32_t type;
+    uint64_t config;
+} const perf_events[] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {"L1d-misses", PERF_TYPE_HW_CACHE,
+     PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8
+     | PERF_COUNT_HW_CACHE_RESULT_MISS << 16},
+    {"LLC-misses", PERF_TYPE_HW_CACHE,
+     PERF_COUNT_HW_CACHE_LL | PERF_COUNT_HW_CACHE_OP_READ << 8
+     | PERF_COUNT_HW_CACHE_RESULT_MISS << 16},
+    {"task-clock-ns", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK}
+};
+
+enum { PERF_EVENTS = sizeof perf_events / sizeof *perf_events };
+
+/* 開いたイベントはひとつのグループにして、1回の read で読む。
+   SLOT[i] は perf_events[i] のグループの中での位置で、開けなければ -1。 */
+static struct {
+    bool active;
+    int leader;
+    int nopen;
+    int slot[PERF_EVENTS];
+    uint64_t last[PERF_EVENTS];
+    uint64_t counts[PERF_PHASES][PERF_EVENTS];
+    uintmax_t bytes;    /* 読み足したバイト数 */
+} perf;
+
+/* perf_events[I] を開き、LEADER のグループに入れる。 カーネルを数える
+   権限がなければ、ユーザー空間だけを数える。 */
+static int
+perf_open(int i, int leader) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof attr);
+    attr.size = sizeof attr;
+    attr.type = perf_events[i].type;
+    attr.config = perf_events[i].config;
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.exclude_hv = 1;
+
+    int fd = syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+    if (fd < 0 && (errno == EACCES || errno == EPERM)) {
+        attr.exclude_kernel = 1;
+        fd = syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+    }
+    return fd;
+}
+
+/* カウンタを開いて数え始める。 ひとつも開けなければ警告して、
+   カウンタなしで続ける。 */
+static void
+perf_start(void) {
+    int err = 0;
+    perf.leader = -1;
+    for (int i = 0; i < PERF_EVENTS; i++) {
+        int fd = perf_open(i, perf.leader);
+        perf.slot[i] = fd < 0 ? -1 : perf.nopen++;
+        if (fd < 0)
+            err = errno;
+        else if (perf.leader < 0)
+            perf.leader = fd;
+    }
+    if (perf.leader < 0) {
+        error(0, err, _("performance counters are unavailable"));
+        return;
+    }
+    perf.active = true;
+}
+
+/* 前の印から今までのカウンタの増分を PHASE に足す。 */
+static void
+perf_mark(enum perf_phase phase) {
+    if (!perf.active)
+        return;
+    uint64_t values[1 + PERF_EVENTS];
+    if (read(perf.leader, values, sizeof values) < (ssize_t) sizeof *values)
+        return;
+    for (int i = 0; i < PERF_EVENTS; i++)
+        if (0 <= perf.slot[i]) {
+            uint64_t v = values[1 + perf.slot[i]];
+            perf.counts[phase][i] += v - perf.last[i];
+            perf.last[i] = v;
+        }
+}
+
+/* 印を付けずに、今のカウンタの値を覚える。 */
+static void
+perf_reset(void) {
+    if (!perf.active)
+        return;
+    uint64_t values[1 + PERF_EVENTS];
+    if (read(perf.leader, values, sizeof values) < (ssize_t) sizeof *values)
+        return;
+    for (int i = 0; i < PERF_EVENTS; i++)
+        if (0 <= perf.slot[i])
+            perf.last[i] = values[1 + perf.slot[i]];
+}
+
+/* 入力を N バイト読み足した。 */
+static void
+perf_bytes(size_t n) {
+    perf.bytes += n;
+}
+
+/* 段階ごとの結果を標準エラーに出す。 */
+static void
+perf_report(void) {
+    if (!perf.active)
+        return;
+    for (int p = 0; p < PERF_PHASES; p++) {
+        char line[512];
+        int len = 0;
+        for (int i = 0; i < PERF_EVENTS && len < (int) sizeof line; i++)
+            if (0 <= perf.slot[i])
+                len += snprintf(line + len, sizeof line - len, "%s%ju %s",
+                                len ? ", " : "",
+                                (uintmax_t) perf.counts[p][i],
+                                perf_events[i].name);
+        if (0 <= perf.slot[0] && perf.bytes && len < (int) sizeof line)
+            snprintf(line + len, sizeof line - len, ", %.3f cycles/byte",
+                     (double) perf.counts[p][0] / perf.bytes);
+        error(0, 0, _("%s: %s"), perf_phase_names[p], line);
+    }
+}
+#else
+static void
+perf_start(void) {
+    error(0, 0, _("performance counters are unavailable"));
+}
+
+static void
+perf_mark(enum perf_phase phase) {
+}
+
+static void
+perf_reset(void) {
+}
+
+static void
+perf_bytes(size_t n) {
 }
 
+static void
+perf_report(void) {
+}
+#endif
+
 /* プレーンなcat。 input_desc' の後ろにあるファイルを
 STDOUT_FILENO にコピーする。
 成功すればtrueを返す。 */
@@ -156,51 +1347,1198 @@ static bool simple_cat(
     /* Actual number of characters read, and therefore written.  */
     // 実際の読み込むバイトサイズ、したがって、書き込むバイトサイズ
     size_t n_read;
+    // 読み込んだブロックの先頭。 io_uring で先読みしているときは buf ではない
+    char *block;
+    perf_reset();
     // EOFまでループする
     while (true) {
-        /* Read a block of input.  */
-        // bufsizeだけbufに読み込む、input_descから（インプットディスクリプター）
-        // safe_read()割り込みで再試行する読み込み
-        n_read = safe_read(input_desc, buf, bufsize);
-        if (n_read == SAFE_READ_ERROR) {
-          // 読み込みにエラーがあった
-            error(0, errno, "%s", quotef(infile));
-            // エラーメッセージを標準エラーに出力し、プロセスを終了させる
-            return false;
+        /* Read a block of input.  */
+        // bufsizeだけbufに読み込む、input_descから（インプットディスクリプター）
+        // safe_read()割り込みで再試行する読み込み
+        xtime_t start = stats_clock();
+        n_read = read_input(buf, bufsize, &block);
+        stats_read(n_read, start);
+        perf_mark(PERF_REFILL);
+        if (n_read == SAFE_READ_ERROR) {
+          // 読み込みにエラーがあった
+            error(0, errno, "%s", quotef(infile));
+            // エラーメッセージを標準エラーに出力し、プロセスを終了させる
+            return false;
+        }
+        if (n_read == 0) {
+          // EOFだった
+          return true;
+        }
+        nocache_input(n_read);
+        perf_bytes(n_read);
+
+        /* Write this block out.  */
+        // ブロックを書き出す
+        {
+          // n_readは読み込めたバイト数
+            /* The following is ok, since we know that 0 < n_read.  */
+            size_t n = n_read;
+            start = stats_clock();
+            if (full_write(STDOUT_FILENO, block, n) != n) {
+            // STDOUT_FILENOが参照するファイルにbufからnバイト書き込む
+            // 失敗したらdieする
+                die(EXIT_FAILURE, errno, _("write error"));
+            }
+            stats_write(n, start);
+            nocache_output(n);
+            perf_mark(PERF_FLUSH);
+        }
+    }
+}
+
+#ifdef __linux__
+/* カーネル内コピー1回あたりの最大バイト数。 min(SSIZE_MAX, SIZE_MAX) を
+   1GiB 単位に切り捨てたもの。 */
+#define COPY_MAX (MIN(SSIZE_MAX, SIZE_MAX) >> 30 << 30)
+
+/* copy_file_range, splice, sendfile が「この組み合わせでは使えない」
+   という意味で返すerrno なら true。その場合は次の方法に切り替える。 */
+static bool
+zero_copy_unsupported(int err) {
+    return (err == ENOSYS || err == EOPNOTSUPP || err == ENOTSUP || err == EINVAL
+            || err == EBADF || err == EXDEV || err == ETXTBSY || err == EPERM);
+}
+
+/* カーネル内コピーの方法。 */
+enum zero_copy_method {
+    COPY_FILE_RANGE, /* 入出力とも通常ファイル */
+    SPLICE,          /* どちらかがパイプ */
+    SENDFILE         /* 入力が mmap できるファイル */
+};
+
+/* METHOD で INPUT_DESC から STDOUT_FILENO にEOFまでコピーする。
+   全部コピーできたら 1、エラーなら -1、使えなければ 0 を返す。
+   /proc のファイルでは入力があっても 0 が返ることがあるので、
+   最初の呼び出しが 0 を返したときも 0 を返して read/write に任せる。 */
+static int
+zero_copy_loop(enum zero_copy_method method) {
+    for (bool some_copied = false;; some_copied = true) {
+        xtime_t start = stats_clock();
+        ssize_t n;
+        switch (method) {
+            case COPY_FILE_RANGE:
+                n = copy_file_range(input_desc, NULL, STDOUT_FILENO, NULL,
+                                    COPY_MAX, 0);
+                break;
+            case SPLICE:
+                n = splice(input_desc, NULL, STDOUT_FILENO, NULL, COPY_MAX,
+                           SPLICE_F_MOVE | SPLICE_F_MORE);
+                break;
+            default:
+                n = sendfile(STDOUT_FILENO, input_desc, NULL, COPY_MAX);
+                break;
+        }
+        if (n == 0)
+            return some_copied;
+        if (n < 0) {
+            if (zero_copy_unsupported(errno))
+                return 0;
+            error(0, errno, "%s", quotef(infile));
+            return -1;
+        }
+        /* カーネル内のコピーは、読んで書いた1回の書き込みとして数える。 */
+        file_stats.bytes_in += n;
+        stats_write(n, start);
+    }
+}
+#endif
+
+/* ユーザー空間のバッファを通さずに INPUT_DESC の後ろにあるファイルを
+   STDOUT_FILENO にコピーする。出力が通常ファイルなら copy_file_range、
+   どちらかがパイプなら splice、それ以外は sendfile を使う。
+   全部コピーできたら 1、エラーなら -1 を返す。カーネルが EINVAL や
+   EXDEV などで断ったら次の方法を試し、どれも使えなければ 0 を返す。
+   どの方法もファイルオフセットを進めるので、0 を返したあとは
+   simple_cat() が続きから読めば出力は同じになる。 */
+static int
+zero_copy_cat(bool in_isreg, bool in_isfifo, bool out_isreg, bool out_isfifo) {
+#ifdef __linux__
+    int status = 0;
+    if (in_isreg && out_isreg)
+        status = zero_copy_loop(COPY_FILE_RANGE);
+    if (status == 0 && (in_isfifo || out_isfifo))
+        status = zero_copy_loop(SPLICE);
+    if (status == 0 && in_isreg)
+        status = zero_copy_loop(SENDFILE);
+    return status;
+#else
+    return 0;
+#endif
+}
+
+/* INPUT_DESC の現在位置から SIZE バイトまでを mmap で読み始める。 */
+static void
+mmap_input_start(off_t size) {
+    off_t pos = lseek(input_desc, 0, SEEK_CUR);
+    if (pos < 0 || size <= pos)
+        return;
+    mmap_in.active = true;
+    mmap_in.base = NULL;
+    mmap_in.len = 0;
+    mmap_in.pos = pos;
+    mmap_in.size = size;
+}
+
+/* mmap での読み込みをやめる。ファイルオフセットを次に渡すバイトに
+   合わせるので、後は read で続きを読める。 */
+static void
+mmap_input_end(void) {
+    if (!mmap_in.active)
+        return;
+    if (mmap_in.base)
+        munmap(mmap_in.base, mmap_in.len);
+    mmap_in.base = NULL;
+    mmap_in.active = false;
+    lseek(input_desc, mmap_in.pos, SEEK_SET);
+}
+
+/* MMAP_IN.POS を含むページから窓を張り直す。失敗すれば false。 */
+static bool
+mmap_input_remap(size_t page_size) {
+    off_t map_off = mmap_in.pos - mmap_in.pos % page_size;
+    size_t len = MIN(MMAP_WINDOW, mmap_in.size - map_off);
+    char *base;
+    if (mmap_in.base)
+        munmap(mmap_in.base, mmap_in.len);
+    mmap_in.base = NULL;
+    base = mmap(NULL, len, PROT_READ, MAP_SHARED, input_desc, map_off);
+    if (base == MAP_FAILED)
+        return false;
+    madvise(base, len, MADV_SEQUENTIAL);
+    mmap_in.base = base;
+    mmap_in.len = len;
+    mmap_in.map_off = map_off;
+    return true;
+}
+
+/* mmap の窓から高々 INSIZE バイトのブロックを取り出し、その先頭を *BPIN
+   に入れて長さを返す。ブロックの直後には必ず改行がある。ブロックを
+   INSIZE 以下に抑えるのは、outbuf の大きさが INSIZE から計算されて
+   いるため。ファイルの終わりなら 0、mmap が使えなければ
+   SAFE_READ_ERROR を返す。 */
+static size_t
+mmap_input_fill(char *inbuf, size_t insize, char **bpin) {
+    size_t page_size = getpagesize();
+    char *p, *end, *nl;
+    bool remapped = false;
+
+    if (mmap_in.size <= mmap_in.pos)
+        return 0;
+    if (!mmap_in.base || mmap_in.pos < mmap_in.map_off
+        || mmap_in.map_off + (off_t)mmap_in.len <= mmap_in.pos) {
+        if (!mmap_input_remap(page_size))
+            return SAFE_READ_ERROR;
+        remapped = true;
+    }
+
+    while (true) {
+        p = mmap_in.base + (mmap_in.pos - mmap_in.map_off);
+        end = mmap_in.base + mmap_in.len;
+
+        /* 先頭の1バイトは飛ばして探す。番兵だけのブロックを作ると、
+           同じ改行を番兵として読み続けてしまう。 */
+        if (1 < end - p) {
+            size_t n = MIN(insize, (size_t)(end - p - 1));
+            nl = memrchr(p + 1, '\n', n);
+            if (nl) {
+                *bpin = p;
+                mmap_in.pos += nl - p;
+                return nl - p;
+            }
+            if (n == insize)
+                break;
+        }
+
+        /* 窓の端で行が切れているなら、行の先頭から窓を張り直す。 */
+        if (remapped || mmap_in.map_off + (off_t)mmap_in.len >= mmap_in.size)
+            break;
+        if (!mmap_input_remap(page_size))
+            return SAFE_READ_ERROR;
+        remapped = true;
+    }
+
+    /* INSIZE より長い行か、改行で終わらないファイルの末尾。 inbuf に
+       コピーして番兵を置く。 */
+    {
+        size_t n = MIN(insize, (size_t)(end - p));
+        memcpy(inbuf, p, n);
+        inbuf[n] = '\n';
+        *bpin = inbuf;
+        mmap_in.pos += n;
+        return n;
+    }
+}
+
+/* 入力ブロックを用意して *BPIN と *EOB を設定する。 *EOB には必ず
+   改行がある。戻り値は safe_read と同じ。 */
+static size_t
+fill_input(char *inbuf, size_t insize, char **bpin, char **eob) {
+    size_t n_read;
+
+    if (mmap_in.active) {
+        n_read = mmap_input_fill(inbuf, insize, bpin);
+        if (n_read != 0 && n_read != SAFE_READ_ERROR) {
+            *eob = *bpin + n_read;
+            return n_read;
+        }
+        /* マップした範囲を読み終えたか、mmap できなかった。ファイルが
+           伸びている場合に備えて、残りは read で読む。 */
+        mmap_input_end();
+    }
+
+    n_read = read_input(inbuf, insize, bpin);
+    if (n_read != SAFE_READ_ERROR && n_read != 0) {
+        *eob = *bpin + n_read;
+        **eob = '\n';
+        nocache_input(n_read);
+    }
+    return n_read;
+}
+
+/* Write any pending output to STDOUT_FILENO.
+   Pending is defined to be the *BPOUT - OUTBUF bytes starting at OUTBUF.
+   Then set *BPOUT to OUTPUT if it's not already that value.  */
+
+static inline void //保留中のデータをすべて書き込む
+//外部の非標準ヘルパー
+write_pending(char *outbuf, char **bpout) {
+    size_t n_write = *bpout - outbuf;
+    if (0 < n_write) {
+        xtime_t start = stats_clock();
+        if (full_write(STDOUT_FILENO, outbuf, n_write) != n_write)
+            die(EXIT_FAILURE, errno, _("write error"));
+        stats_write(n_write, start);
+        nocache_output(n_write);
+        *bpout = outbuf;
+    }
+}
+
+/* cat() で、整形しても変わらないブロックを outbuf を通さずに書き出す
+   最小の大きさ。 これより小さいと、まとめて書けなくなる分が写すより
+   高くつく。 */
+enum { PASS_THROUGH_MIN = 32 * 1024 };
+
+/* --writev で、出力に使う iovec の数。 */
+#ifdef IOV_MAX
+enum { GATHER_IOV = IOV_MAX < 1024 ? IOV_MAX : 1024 };
+#else
+enum { GATHER_IOV = 16 };
+#endif
+
+/* --writev で、これより短い入力の切れ端はコピーしてまとめる。 */
+enum { GATHER_COPY_MIN = 128 };
+
+/* --writev で、行番号や短い切れ端をコピーしておく場所の大きさ。 */
+enum { GATHER_ARENA = 64 * 1024 };
+
+/* --writev のときの出力。 整形した結果を outbuf に作る代わりに、入力の
+   バッファの切れ端と、行番号や "$" などの短い断片を iovec に並べ、
+   writev でまとめて書き出す。 切れ端は入力のバッファを指しているので、
+   入力を読み足す前に必ず書き出す。 -v では使わない。 */
+static struct {
+    bool active;
+    int iovcnt;
+    size_t arena_used;
+    struct iovec iov[GATHER_IOV];
+    char arena[GATHER_ARENA];
+} gather;
+
+/* たまっている出力を書き出す。 */
+static void
+gather_flush(void) {
+    struct iovec *iov = gather.iov;
+    int iovcnt = gather.iovcnt;
+
+    while (iovcnt > 0) {
+        xtime_t start = stats_clock();
+        ssize_t n_written = writev(STDOUT_FILENO, iov, iovcnt);
+        if (n_written <= 0) {
+            if (n_written < 0 && errno == EINTR)
+                continue;
+            if (n_written == 0)
+                errno = ENOSPC;
+            die(EXIT_FAILURE, errno, _("write error"));
+        }
+        stats_write(n_written, start);
+        nocache_output(n_written);
+        /* 書けたところまで iovec を進める。 */
+        while (iovcnt > 0 && iov->iov_len <= (size_t) n_written) {
+            n_written -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *) iov->iov_base + n_written;
+            iov->iov_len -= n_written;
+        }
+    }
+
+    gather.iovcnt = 0;
+    gather.arena_used = 0;
+}
+
+/* P から N バイトを出力に加える。 COPY か、短ければ arena にコピーして、
+   直前の断片とつなげる。 そうでなければ P をそのまま指す。 */
+static void
+gather_add(char const *p, size_t n, bool copy) {
+    if (n == 0)
+        return;
+
+    if (copy || n < GATHER_COPY_MIN) {
+        char *dst = gather.arena + gather.arena_used;
+        struct iovec *last = &gather.iov[gather.iovcnt];
+        bool joins = (gather.iovcnt > 0
+                      && (char *) last[-1].iov_base + last[-1].iov_len == dst);
+        if (GATHER_ARENA - gather.arena_used < n
+            || (!joins && gather.iovcnt == GATHER_IOV)) {
+            gather_flush();
+            dst = gather.arena;
+            joins = false;
+        }
+        memcpy(dst, p, n);
+        gather.arena_used += n;
+        if (joins) {
+            last[-1].iov_len += n;
+            return;
+        }
+        p = dst;
+    } else if (gather.iovcnt == GATHER_IOV)
+        gather_flush();
+
+    gather.iov[gather.iovcnt].iov_base = (char *) p;
+    gather.iov[gather.iovcnt].iov_len = n;
+    gather.iovcnt++;
+}
+
+/* format_lines() と同じように OPTIONS で整形するが、結果を gather に
+   並べる。 番兵の改行 EOB を読むまで戻らない。 */
+static void
+gather_lines(char **bpinp, char *eob, int *newlinesp, struct line_counter *lc,
+             unsigned int options) {
+    bool show_tabs = options & CAT_SHOW_TABS;
+    bool number = options & CAT_NUMBER;
+    bool number_nonblank = options & CAT_NUMBER_NONBLANK;
+    bool show_ends = options & CAT_SHOW_ENDS;
+    bool squeeze_blank = options & CAT_SQUEEZE_BLANK;
+    char *bpin = *bpinp;
+    int newlines = *newlinesp;
+
+    while (true) {
+        if (*bpin == '\n') {
+            if (eob < ++bpin)
+                break;
+
+            /* 本物の改行。 format_lines() と同じ扱い。 */
+            if (++newlines > 0) {
+                if (newlines >= 2) {
+                    newlines = 2;
+                    if (squeeze_blank)
+                        continue;
+                }
+                if (number && !number_nonblank) {
+                    next_line_num(lc);
+                    gather_add(lc->buf + lc->print, lc->len, true);
+                }
+            }
+            gather_add(show_ends ? "$\n" : "\n", show_ends + 1, true);
+            continue;
+        }
+
+        if (newlines >= 0 && number) {
+            next_line_num(lc);
+            gather_add(lc->buf + lc->print, lc->len, true);
+        }
+
+        /* 行の残り。 -T ならタブで切る。 */
+        char *run = bpin;
+        while (true) {
+            char *p = scan_special(run, eob + 1, show_tabs, false);
+            if (*p == '\t') {
+                gather_add(run, p - run, false);
+                gather_add("^I", 2, true);
+                run = p + 1;
+                continue;
+            }
+
+            /* 改行。 -E でなければ、本物の改行は切れ端に含めてしまう。 */
+            if (p < eob && !show_ends) {
+                gather_add(run, p + 1 - run, false);
+                newlines = 0;
+                bpin = p + 1;
+            } else {
+                gather_add(run, p - run, false);
+                newlines = -1;
+                bpin = p;
+            }
+            break;
+        }
+    }
+
+    *bpinp = bpin;
+    *newlinesp = newlines;
+}
+
+#if USE_IO_URING
+/* 小さなファイルを io_uring でまとめて扱うときの、1回のファイルの数。 */
+enum { SMALL_BATCH = 64 };
+
+/* まとめて扱うファイルの大きさの上限と、1回に読む合計の上限。 */
+enum { SMALL_FILE_MAX = 64 * 1024, SMALL_BATCH_BYTES = 1024 * 1024 };
+
+/* 多数の小さなファイルを、オプションなしで cat するときの状態。
+   SMALL_BATCH 個ずつ、まず statx をまとめて発行し、小さな通常ファイル
+   だけについて、固定ファイル表への openat、read、close をつないで
+   まとめて発行する。 読めた内容は引数の順に gather で書き出す。
+   それ以外のファイルや失敗したファイルは、その番が来たときにふつうに
+   開くので、エラーの報告もふつうと同じになる。 ファイルを読む時点が
+   ふつうより早くなるので、--io-engine=io_uring のときだけ使う。 */
+static struct {
+    bool active;
+    struct uring ring;
+    char **argv;
+    int argc;
+    int open_mode;
+    bool out_isreg;
+    dev_t out_dev;
+    ino_t out_ino;
+    int first;              /* 今のまとまりの最初の argv の番号 */
+    int end;                /* 今のまとまりの終わり */
+    struct {
+        struct statx stx;
+        int stx_res;
+        int open_res;
+        int read_res;
+        bool queued;        /* openat と read を発行した */
+        char *buf;
+    } files[SMALL_BATCH];
+    char *arena;            /* SMALL_BATCH_BYTES の読み込み先 */
+} small;
+
+/* ARGV[FIRST] から ARGC の手前までを、まとめて扱う準備をする。
+   io_uring の固定ファイル表を用意できなければ何もしない。 */
+static void
+small_files_start(char **argv, int first, int argc, int open_mode,
+                  bool out_isreg, dev_t out_dev, ino_t out_ino) {
+    int fds[SMALL_BATCH];
+
+    if (argc - first < 2 || !uring_init(&small.ring, 2 * SMALL_BATCH))
+        return;
+    for (int i = 0; i < SMALL_BATCH; i++)
+        fds[i] = -1;
+    if (syscall(__NR_io_uring_register, small.ring.fd, IORING_REGISTER_FILES,
+                fds, SMALL_BATCH) != 0)
+        return;
+
+    small.argv = argv;
+    small.argc = argc;
+    small.open_mode = open_mode;
+    small.out_isreg = out_isreg;
+    small.out_dev = out_dev;
+    small.out_ino = out_ino;
+    small.first = small.end = first;
+    small.arena = xmalloc(SMALL_BATCH_BYTES);
+    small.active = true;
+}
+
+/* 発行した N 個の完了をすべて待ち、結果を files に記録する。 */
+static bool
+small_files_wait(unsigned n) {
+    while (n != 0) {
+        struct io_uring_cqe *cqe;
+        if (uring_enter(&small.ring, 1) < 0)
+            return false;
+        while (n != 0 && (cqe = uring_peek_cqe(&small.ring))) {
+            unsigned i = cqe->user_data >> 2;
+            switch (cqe->user_data & 3) {
+                case 0:
+                    small.files[i].stx_res = cqe->res;
+                    break;
+                case 1:
+                    small.files[i].open_res = cqe->res;
+                    break;
+                case 2:
+                    small.files[i].read_res = cqe->res;
+                    break;
+            }
+            uring_cqe_seen(&small.ring);
+            n--;
+        }
+    }
+    return true;
+}
+
+/* ARGV[FIRST] からの次のまとまりを読む。 */
+static void
+small_files_batch(int first) {
+    int n = MIN(SMALL_BATCH, small.argc - first);
+    unsigned queued = 0;
+
+    /* 前のまとまりの内容は arena を指しているので、先に書き出す。 */
+    gather_flush();
+    small.first = first;
+
+    for (int i = 0; i < n; i++) {
+        char const *name = small.argv[first + i];
+        small.files[i].queued = false;
+        small.files[i].stx_res = -1;
+        if (STREQ(name, "-"))
+            continue;
+        struct io_uring_sqe *sqe = uring_get_sqe(&small.ring);
+        sqe->opcode = IORING_OP_STATX;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (uintptr_t) name;
+        sqe->len = STATX_TYPE | STATX_SIZE | STATX_INO;
+        sqe->off = (uintptr_t) &small.files[i].stx;
+        sqe->user_data = (uint64_t) i << 2;
+        queued++;
+    }
+    if (!small_files_wait(queued))
+        goto fail;
+
+    /* 小さな通常ファイルを、固定ファイル表の i 番に開いて読んで閉じる。
+       入れ替えられて FIFO になっていても止まらないように O_NONBLOCK で
+       開く。 */
+    size_t used = 0;
+    queued = 0;
+    int i;
+    for (i = 0; i < n; i++) {
+        struct statx const *stx = &small.files[i].stx;
+        if (small.files[i].stx_res != 0 || !S_ISREG(stx->stx_mode)
+            || SMALL_FILE_MAX < stx->stx_size)
+            continue;
+        if (small.out_isreg && stx->stx_ino == small.out_ino
+            && makedev(stx->stx_dev_major, stx->stx_dev_minor) == small.out_dev)
+            continue;
+        /* ファイルが伸びていたら読み切れなかったとわかるように、
+           1バイト多く読む。 */
+        size_t len = stx->stx_size + 1;
+        if (SMALL_BATCH_BYTES - used < len)
+            break;
+        small.files[i].buf = small.arena + used;
+        used += len;
+
+        struct io_uring_sqe *sqe = uring_get_sqe(&small.ring);
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (uintptr_t) small.argv[first + i];
+        sqe->open_flags = small.open_mode | O_NONBLOCK;
+        sqe->file_index = i + 1;
+        sqe->flags = IOSQE_IO_LINK;
+        sqe->user_data = ((uint64_t) i << 2) | 1;
+
+        sqe = uring_get_sqe(&small.ring);
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = i;
+        sqe->addr = (uintptr_t) small.files[i].buf;
+        sqe->len = len;
+        sqe->off = 0;
+        sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+        sqe->user_data = ((uint64_t) i << 2) | 2;
+
+        sqe = uring_get_sqe(&small.ring);
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->file_index = i + 1;
+        sqe->user_data = ((uint64_t) i << 2) | 3;
+
+        small.files[i].queued = true;
+        small.files[i].open_res = small.files[i].read_res = -1;
+        queued += 3;
+
+        /* リングに収まるように、途中で発行して待つ。 */
+        if (2 * SMALL_BATCH - 3 < queued) {
+            if (!small_files_wait(queued))
+                goto fail;
+            queued = 0;
+        }
+    }
+    if (!small_files_wait(queued))
+        goto fail;
+    small.end = first + i;
+    return;
+
+fail:
+    small.active = false;
+    small.end = first;
+}
+
+/* ARGV[ARGIND] の番が来た。 まとめて読んであれば出力に加えて true を
+   返す。 そうでなければ、それまでの出力を書き出して false を返す。 */
+static bool
+small_files_take(int argind) {
+    if (!small.active)
+        return false;
+    if (argind < small.first || small.end <= argind)
+        small_files_batch(argind);
+
+    if (small.first <= argind && argind < small.end) {
+        int i = argind - small.first;
+        if (small.files[i].queued && small.files[i].open_res >= 0
+            && 0 <= small.files[i].read_res
+            && (uint64_t) small.files[i].read_res <= small.files[i].stx.stx_size) {
+            stats_read(small.files[i].read_res, stats_clock());
+            gather_add(small.files[i].buf, small.files[i].read_res, false);
+            return true;
+        }
+    }
+    gather_flush();
+    return false;
+}
+
+/* まとめて読んだ残りを書き出す。 */
+static void
+small_files_end(void) {
+    if (small.active)
+        gather_flush();
+}
+#else
+static struct {
+    bool active;
+} small;
+
+static void
+small_files_start(char **argv, int first, int argc, int open_mode,
+                  bool out_isreg, dev_t out_dev, ino_t out_ino) {
+}
+
+static bool
+small_files_take(int argind) {
+    return false;
+}
+
+static void
+small_files_end(void) {
+}
+#endif
+
+/* --parallel で整形するときの、1スレッドあたりの入力のおおよその大きさ。 */
+enum { PARALLEL_CHUNK = 2 * 1024 * 1024 };
+
+/* --parallel で整形するときの、ファイルの一区切り。 区切りの終わりは
+   直前が改行でない改行で、それを番兵にする。 そこでの newlines は必ず
+   -1 なので、次の区切りは前の区切りを待たずに整形できる。 -s で詰める
+   空行の並びや -b で飛ばす空行が、区切りをまたぐことはない。 */
+struct parallel_chunk {
+    char *begin;            /* 最初のバイト */
+    char *end;              /* 番兵にする改行 */
+    int newlines;           /* 入口での newlines */
+    uintmax_t lines;        /* この区切りで振る行番号の数 */
+    uintmax_t nl;           /* この区切りの改行の数 */
+    struct line_counter lc; /* この区切りの行番号 */
+    char *out;              /* 整形した結果 */
+    size_t out_alloc;
+    size_t out_len;
+    pthread_t tid;          /* この区切りを扱うスレッド */
+    bool started;           /* tid を作れた */
+    xtime_t format_time;    /* --stats: 数えて整形するのにかかった時間 */
+};
+
+/* 並列に整形するスレッドが共に使うオプション。 CAT_* の論理和。 */
+static unsigned int parallel_options;
+
+/* --parallel のスレッドの数。 1 以下なら並列には整形しない。 */
+static size_t parallel_threads;
+
+/* P から END の手前までを整形したときに振る行番号を数える。 *NEWLINESP は
+   入口と出口での newlines、*NLP には改行の数を入れる。
+   format_lines() の改行の扱いと合わせておくこと。 */
+static uintmax_t
+count_lines(char const *p, char const *end, int *newlinesp, uintmax_t *nlp) {
+    bool number = parallel_options & CAT_NUMBER;
+    bool number_nonblank = parallel_options & CAT_NUMBER_NONBLANK;
+    bool squeeze_blank = parallel_options & CAT_SQUEEZE_BLANK;
+    int newlines = *newlinesp;
+    uintmax_t lines = 0;
+    uintmax_t nl = 0;
+
+    while (p < end) {
+        if (*p == '\n') {
+            p++;
+            nl++;
+            if (++newlines > 0) {
+                if (newlines >= 2) {
+                    newlines = 2;
+                    if (squeeze_blank)
+                        continue;
+                }
+                if (!number_nonblank)
+                    lines++;
+            }
+        } else {
+            if (newlines >= 0)
+                lines++;
+            newlines = -1;
+            p = memchr(p, '\n', end - p);
+            if (!p)
+                break;
+        }
+    }
+
+    *newlinesp = newlines;
+    *nlp = nl;
+    return number ? lines : 0;
+}
+
+/* 区切り C の改行と、整形したときに振る行番号を数える。 */
+static void *
+parallel_count(void *arg) {
+    struct parallel_chunk *c = arg;
+    int newlines = c->newlines;
+    xtime_t start = stats_clock();
+
+    c->lines = count_lines(c->begin, c->end, &newlines, &c->nl);
+    c->format_time += stats_clock() - start;
+    return NULL;
+}
+
+/* 区切り C を C->out に整形する。 */
+static void *
+parallel_format(void *arg) {
+    struct parallel_chunk *c = arg;
+    char *bpin = c->begin;
+    char *bpout = c->out;
+    int newlines = c->newlines;
+    xtime_t start = stats_clock();
+
+    while (bpin <= c->end)
+        bpout = stdout_ctx.format(&bpin, c->end, bpout,
+                                  c->out + c->out_alloc, &newlines, &c->lc);
+    c->out_len = bpout - c->out;
+    c->format_time += stats_clock() - start;
+    return NULL;
+}
+
+/* FN を N 個の区切りに対して、別々のスレッドで呼ぶ。 最初の区切りは
+   このスレッドで扱い、スレッドを作れなかった区切りもここで扱う。 */
+static void
+parallel_run(void *(*fn)(void *), struct parallel_chunk *chunks, size_t n) {
+    for (size_t i = 1; i < n; i++)
+        chunks[i].started = pthread_create(&chunks[i].tid, NULL, fn,
+                                           &chunks[i]) == 0;
+    fn(&chunks[0]);
+    for (size_t i = 1; i < n; i++) {
+        if (chunks[i].started)
+            pthread_join(chunks[i].tid, NULL);
+        else
+            fn(&chunks[i]);
+    }
+}
+
+/* P から LIMIT の手前までで、最初の区切りになる改行を探す。
+   なければ LIMIT を返す。 P の直前のバイトは読めなければならない。 */
+static char *
+parallel_boundary(char *p, char *limit) {
+    while (p < limit) {
+        char *q = memchr(p, '\n', limit - p);
+        if (!q)
+            break;
+        if (q[-1] != '\n')
+            return q;
+        p = q + 1;
+    }
+    return limit;
+}
+
+/* 通常ファイル INPUT_DESC の現在の位置から、最後の区切りまでを
+   PARALLEL_THREADS 個のスレッドで OPTIONS で整形して書き出す。 残りは cat() が
+   続きから扱う。 ファイルが小さいときや mmap できないときは何もしない。
+   エラーを報告したときは false を返す。 */
+static bool
+parallel_cat(off_t size, unsigned int options) {
+    off_t pos = lseek(input_desc, 0, SEEK_CUR);
+    if (pos < 0 || size - pos < 2 * PARALLEL_CHUNK
+        || (uintmax_t) (size - pos) > SIZE_MAX)
+        return true;
+
+    size_t page_size = getpagesize();
+    off_t map_off = pos - pos % page_size;
+    size_t map_len = size - map_off;
+    char *base = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, input_desc,
+                      map_off);
+    if (base == MAP_FAILED)
+        return true;
+
+    char *begin = base + (pos - map_off);
+    char *lim = begin + (size - pos);
+    char *last = NULL;
+
+    /* 最後の区切り。 そこから後ろは cat() に任せる。 */
+    while (begin < lim) {
+        char *q = memrchr(begin, '\n', lim - begin);
+        if (!q || q == begin)
+            break;
+        if (q[-1] != '\n') {
+            last = q;
+            break;
+        }
+        lim = q;
+    }
+    if (!last || last - begin < 2 * PARALLEL_CHUNK) {
+        munmap(base, map_len);
+        return true;
+    }
+
+    parallel_options = options;
+
+    size_t nthreads = parallel_threads;
+    struct parallel_chunk *chunks = xcalloc(nthreads, sizeof *chunks);
+    int newlines = stdout_ctx.newlines;
+    char *p = begin;
+
+    while (p < last) {
+        size_t n = 0;
+        while (n < nthreads && p < last) {
+            struct parallel_chunk *c = &chunks[n++];
+            c->begin = p;
+            c->end = (last - p <= PARALLEL_CHUNK
+                      ? last
+                      : parallel_boundary(p + PARALLEL_CHUNK, last));
+            c->newlines = newlines;
+            c->format_time = 0;
+            newlines = -1;
+            p = c->end;
+            /* --stats では、マップした区切りを1回の読み込みとして数える。
+               ページを読む時間は整形の時間に入る。 */
+            stats_read(c->end - c->begin, stats_clock());
+        }
+
+        /* 区切りごとの行番号の数を足し合わせて、それぞれの区切りの
+           最初の行番号を決める。 */
+        parallel_run(parallel_count, chunks, n);
+        uintmax_t line = line_counter_value(&stdout_ctx.lc);
+        for (size_t i = 0; i < n; i++) {
+            struct parallel_chunk *c = &chunks[i];
+            size_t need = ((c->end - c->begin) * 4
+                           + (c->nl + 1) * (LINE_COUNTER_BUF_LEN + 1) + 64);
+            if (c->out_alloc < need) {
+                free(c->out);
+                c->out = xmalloc(need);
+                c->out_alloc = need;
+            }
+            c->lc = stdout_ctx.lc;
+            line_counter_set(&c->lc, line);
+            line += c->lines;
+        }
+        if (options & CAT_NUMBER)
+            line_counter_set(&stdout_ctx.lc, line);
+
+        parallel_run(parallel_format, chunks, n);
+        for (size_t i = 0; i < n; i++) {
+            file_stats.format_time += chunks[i].format_time;
+            xtime_t start = stats_clock();
+            if (full_write(STDOUT_FILENO, chunks[i].out, chunks[i].out_len)
+                != chunks[i].out_len)
+                die(EXIT_FAILURE, errno, _("write error"));
+            stats_write(chunks[i].out_len, start);
+            nocache_output(chunks[i].out_len);
+        }
+    }
+
+    for (size_t i = 0; i < nthreads; i++)
+        free(chunks[i].out);
+    free(chunks);
+    munmap(base, map_len);
+    stdout_ctx.newlines = newlines;
+
+    if (lseek(input_desc, pos + (last - begin), SEEK_SET) < 0) {
+        error(0, errno, "%s", quotef(infile));
+        return false;
+    }
+    return true;
+}
+
+/* --parallel でパイプなどから読むときの、ブロックの大きさ。 */
+enum { PIPELINE_BLOCK = 1024 * 1024 };
+
+/* パイプラインを流れるブロック。 ブロックは行の途中で切れてもよい。
+   前のブロックを待たずに、先頭の改行の並びとその後ろとを数えておき、
+   継ぎ目で前のブロックの状態と合わせる。 */
+struct pipeline_block {
+    char *in;               /* 読んだデータ。 末尾に番兵の改行を置く */
+    size_t in_len;
+    char *out;              /* 整形した結果 */
+    size_t out_alloc;
+    size_t out_len;
+    bool done;              /* 整形が済んだ */
+    uintmax_t lead;         /* 先頭に続く改行の数 */
+    uintmax_t lines;        /* 先頭の改行の並びの後ろで振る行番号の数。
+                               その直前が改行だったとして数える */
+    uintmax_t nl;           /* 改行の数 */
+    int exit_newlines;      /* 先頭の改行の並びの後ろがあれば、
+                               末尾での newlines */
+};
+
+/* 読むスレッド、整形するスレッド、書き出すスレッドが共有する状態。
+   ブロックは番号順に blocks を輪のように使い、番号を剰余で割り当てる。 */
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct pipeline_block *blocks;
+    size_t nblocks;
+    size_t bufsize;
+    uintmax_t read_seq;     /* 読み終えたブロックの数 */
+    uintmax_t work_seq;     /* 整形に取りかかったブロックの数 */
+    uintmax_t seam_seq;     /* 継ぎ目を合わせたブロックの数 */
+    uintmax_t write_seq;    /* 書き出したブロックの数 */
+    int newlines;           /* seam_seq 番目のブロックの入口での newlines */
+    uintmax_t line;         /* その直前に振った行番号 */
+    bool eof;               /* これ以上は読まない */
+    int read_errno;         /* 読み込みのエラー */
+    xtime_t format_time;    /* --stats: 整形するスレッドが数えて整形するのに
+                               かかった時間の合計 */
+} pipeline = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER
+};
+
+/* 入口での newlines が *NEWLINESP のとき、ブロック B で振る行番号の数を
+   返し、*NEWLINESP を出口での newlines にする。 */
+static uintmax_t
+pipeline_seam(struct pipeline_block const *b, int *newlinesp) {
+    bool number = parallel_options & CAT_NUMBER;
+    bool number_nonblank = parallel_options & CAT_NUMBER_NONBLANK;
+    bool squeeze_blank = parallel_options & CAT_SQUEEZE_BLANK;
+    int newlines = *newlinesp;
+    uintmax_t lines = 0;
+    uintmax_t n = b->lead;
+
+    /* 先頭の改行の並び。 newlines が 2 になった後は同じことの繰り返し。 */
+    for (; n != 0 && newlines < 2; n--) {
+        if (++newlines > 0) {
+            if (newlines == 2 && squeeze_blank)
+                continue;
+            if (!number_nonblank)
+                lines++;
+        }
+    }
+    if (!squeeze_blank && !number_nonblank)
+        lines += n;
+
+    if (b->lead < b->in_len) {
+        lines += b->lines - (newlines < 0 && number);
+        newlines = b->exit_newlines;
+    }
+
+    *newlinesp = newlines;
+    return number ? lines : 0;
+}
+
+/* ブロックを読んで、番号順に渡す。 */
+static void *
+pipeline_reader(void *arg) {
+    (void) arg;
+    pthread_mutex_lock(&pipeline.lock);
+    while (true) {
+        while (pipeline.read_seq - pipeline.write_seq == pipeline.nblocks)
+            pthread_cond_wait(&pipeline.cond, &pipeline.lock);
+        struct pipeline_block *b
+            = &pipeline.blocks[pipeline.read_seq % pipeline.nblocks];
+        pthread_mutex_unlock(&pipeline.lock);
+
+        /* すぐに読めるだけ読む。 待つことになるなら、そこまでで渡して
+           ふつうの cat と同じように出力を遅らせない。 */
+        size_t len = 0;
+        int err = 0;
+        bool eof = false;
+        while (len < pipeline.bufsize) {
+            /* 読み込みの統計を取るのはこのスレッドだけ。 */
+            xtime_t start = stats_clock();
+            size_t n_read = safe_read(input_desc, b->in + len,
+                                      pipeline.bufsize - len);
+            stats_read(n_read, start);
+            if (n_read == SAFE_READ_ERROR) {
+                err = errno;
+                break;
+            }
+            if (n_read == 0) {
+                eof = true;
+                break;
+            }
+            len += n_read;
+#ifdef FIONREAD
+            int n_to_read;
+            if (ioctl(input_desc, FIONREAD, &n_to_read) == 0 && n_to_read != 0)
+                continue;
+#endif
+            break;
         }
-        if (n_read == 0) {
-          // EOFだった
-          return true;
+        b->in[len] = '\n';
+        b->in_len = len;
+        b->done = false;
+
+        pthread_mutex_lock(&pipeline.lock);
+        if (len != 0)
+            pipeline.read_seq++;
+        if (err || eof) {
+            pipeline.read_errno = err;
+            pipeline.eof = true;
         }
+        pthread_cond_broadcast(&pipeline.cond);
+        if (pipeline.eof)
+            break;
+    }
+    pthread_mutex_unlock(&pipeline.lock);
+    return NULL;
+}
 
-        /* Write this block out.  */
-        // ブロックを書き出す
-        {
-          // n_readは読み込めたバイト数
-            /* The following is ok, since we know that 0 < n_read.  */
-            size_t n = n_read;
-            if (full_write(STDOUT_FILENO, buf, n) != n) {
-            // STDOUT_FILENOが参照するファイルにbufからnバイト書き込む
-            // 失敗したらdieする
-                die(EXIT_FAILURE, errno, _("write error"));
-            }
+/* ブロックを数え、継ぎ目を合わせ、整形する。 */
+static void *
+pipeline_worker(void *arg) {
+    (void) arg;
+    struct line_counter lc = stdout_ctx.lc;
+
+    pthread_mutex_lock(&pipeline.lock);
+    while (true) {
+        while (pipeline.work_seq == pipeline.read_seq && !pipeline.eof)
+            pthread_cond_wait(&pipeline.cond, &pipeline.lock);
+        if (pipeline.work_seq == pipeline.read_seq)
+            break;
+        uintmax_t seq = pipeline.work_seq++;
+        struct pipeline_block *b = &pipeline.blocks[seq % pipeline.nblocks];
+        pthread_mutex_unlock(&pipeline.lock);
+
+        xtime_t start = stats_clock();
+        char *end = b->in + b->in_len;
+        char *p = b->in;
+        while (p < end && *p == '\n')
+            p++;
+        b->lead = p - b->in;
+        b->exit_newlines = 0;
+        b->lines = count_lines(p, end, &b->exit_newlines, &b->nl);
+        b->nl += b->lead;
+
+        /* 前のブロックの出口の状態を待って、入口の状態を決める。 */
+        xtime_t format_time = stats_clock() - start;
+        pthread_mutex_lock(&pipeline.lock);
+        while (pipeline.seam_seq != seq)
+            pthread_cond_wait(&pipeline.cond, &pipeline.lock);
+        int newlines = pipeline.newlines;
+        uintmax_t line = pipeline.line;
+        pipeline.line += pipeline_seam(b, &pipeline.newlines);
+        pipeline.seam_seq++;
+        pthread_cond_broadcast(&pipeline.cond);
+        pthread_mutex_unlock(&pipeline.lock);
+
+        size_t need = (b->in_len * 4
+                       + (b->nl + 1) * (LINE_COUNTER_BUF_LEN + 1) + 64);
+        if (b->out_alloc < need) {
+            free(b->out);
+            b->out = xmalloc(need);
+            b->out_alloc = need;
         }
+        start = stats_clock();
+        line_counter_set(&lc, line);
+        char *bpin = b->in;
+        char *bpout = b->out;
+        while (bpin <= end)
+            bpout = stdout_ctx.format(&bpin, end, bpout,
+                                      b->out + b->out_alloc, &newlines, &lc);
+        b->out_len = bpout - b->out;
+        format_time += stats_clock() - start;
+
+        pthread_mutex_lock(&pipeline.lock);
+        pipeline.format_time += format_time;
+        b->done = true;
+        pthread_cond_broadcast(&pipeline.cond);
     }
+    pthread_mutex_unlock(&pipeline.lock);
+    return NULL;
 }
 
-/* Write any pending output to STDOUT_FILENO.
-   Pending is defined to be the *BPOUT - OUTBUF bytes starting at OUTBUF.
-   Then set *BPOUT to OUTPUT if it's not already that value.  */
+/* パイプなど、前もって区切れない INPUT_DESC を、読むスレッドと
+   PARALLEL_THREADS 個の整形するスレッドで OPTIONS で整形し、このスレッドで
+   順番に書き出す。 成功すれば 1、エラーを報告したら 0、スレッドを
+   作れなかったら何もせずに -1 を返す。 */
+static int
+pipeline_cat(size_t insize, unsigned int options) {
+    size_t nworkers = parallel_threads;
+    pthread_t *tids = xnmalloc(nworkers + 1, sizeof *tids);
+
+    parallel_options = options;
+
+    pipeline.bufsize = MAX(insize, PIPELINE_BLOCK);
+    pipeline.nblocks = 2 * nworkers;
+    pipeline.blocks = xcalloc(pipeline.nblocks, sizeof *pipeline.blocks);
+    for (size_t i = 0; i < pipeline.nblocks; i++)
+        pipeline.blocks[i].in = xmalloc(pipeline.bufsize + 1);
+    pipeline.read_seq = pipeline.work_seq = 0;
+    pipeline.seam_seq = pipeline.write_seq = 0;
+    pipeline.newlines = stdout_ctx.newlines;
+    pipeline.line = line_counter_value(&stdout_ctx.lc);
+    pipeline.eof = false;
+    pipeline.read_errno = 0;
+    pipeline.format_time = 0;
+
+    size_t nstarted = 0;
+    while (nstarted < nworkers
+           && pthread_create(&tids[nstarted + 1], NULL, pipeline_worker,
+                             NULL) == 0)
+        nstarted++;
+    if (nstarted == 0
+        || pthread_create(&tids[0], NULL, pipeline_reader, NULL) != 0) {
+        pthread_mutex_lock(&pipeline.lock);
+        pipeline.eof = true;
+        pthread_cond_broadcast(&pipeline.cond);
+        pthread_mutex_unlock(&pipeline.lock);
+        for (size_t i = 0; i < nstarted; i++)
+            pthread_join(tids[i + 1], NULL);
+        nworkers = 0;
+    }
 
-static inline void //保留中のデータをすべて書き込む
-//外部の非標準ヘルパー
-write_pending(char *outbuf, char **bpout) {
-    size_t n_write = *bpout - outbuf;
-    if (0 < n_write) {
-        if (full_write(STDOUT_FILENO, outbuf, n_write) != n_write)
+    /* 整形が済んだブロックを番号順に書き出す。 */
+    pthread_mutex_lock(&pipeline.lock);
+    while (nworkers != 0) {
+        if (pipeline.write_seq == pipeline.read_seq) {
+            if (pipeline.eof)
+                break;
+            pthread_cond_wait(&pipeline.cond, &pipeline.lock);
+            continue;
+        }
+        struct pipeline_block *b
+            = &pipeline.blocks[pipeline.write_seq % pipeline.nblocks];
+        if (!b->done) {
+            pthread_cond_wait(&pipeline.cond, &pipeline.lock);
+            continue;
+        }
+        pthread_mutex_unlock(&pipeline.lock);
+        xtime_t start = stats_clock();
+        if (full_write(STDOUT_FILENO, b->out, b->out_len) != b->out_len)
             die(EXIT_FAILURE, errno, _("write error"));
-        *bpout = outbuf;
+        stats_write(b->out_len, start);
+        nocache_output(b->out_len);
+        pthread_mutex_lock(&pipeline.lock);
+        pipeline.write_seq++;
+        pthread_cond_broadcast(&pipeline.cond);
     }
+    pthread_mutex_unlock(&pipeline.lock);
+
+    if (nworkers != 0) {
+        for (size_t i = 0; i <= nstarted; i++)
+            pthread_join(tids[i], NULL);
+        stdout_ctx.newlines = pipeline.newlines;
+        if (options & CAT_NUMBER)
+            line_counter_set(&stdout_ctx.lc, pipeline.line);
+        file_stats.format_time += pipeline.format_time;
+    }
+
+    for (size_t i = 0; i < pipeline.nblocks; i++) {
+        free(pipeline.blocks[i].in);
+        free(pipeline.blocks[i].out);
+    }
+    free(pipeline.blocks);
+    free(tids);
+
+    if (nworkers == 0)
+        return -1;
+    if (pipeline.read_errno) {
+        error(0, pipeline.read_errno, "%s", quotef(infile));
+        return 0;
+    }
+    return 1;
 }
 
 /* Cat the file behind INPUT_DESC to the file behind OUTPUT_DESC.
@@ -229,13 +2567,8 @@ cat(
     // outsize (size_t): これは各書き込み呼び出しで書き込まれる文字の数を示します。つまり、関数が一度に書き込むデータのサイズを定義します。
     size_t outsize,
 
-    /* Variables that have values according to the specified options.  */
-    bool show_nonprinting,//-v
-    bool show_tabs,//-T
-    bool number,//-n
-    bool number_nonblank,//-b
-    bool show_ends,//-E
-    bool squeeze_blank /* -s */) {
+    // options (unsigned int): 指定されたオプションの CAT_* の論理和。 stdout_ctx.format はこれで選んである
+    unsigned int options) {
       // cat()とsimple_cat()の比較
 // 入力がそのまま出力にコピーされるのであれば、simple_cat()が適しています。
 // しかし、追加のフォーマットが要求される場合
@@ -243,9 +2576,6 @@ cat(
 // 後者は、40行に対して300行と、より複雑です。
 
 // １　初期化
-// ch (unsigned char): これは最後に入力バッファから読み取った文字を保持します。文字は1バイト（unsigned char）で表現され、この変数はその文字を保存しています
-    unsigned char ch;
-
     // bpin (char *): これは「Buffer Pointer IN」の略で、入力バッファで次に読むべき文字の場所を指すポインタです。つまり、bpinが指す場所にはまだ読んでいないデータが存在します。
     char *bpin;
 
@@ -266,7 +2596,7 @@ cat(
 // - `newlines` が 2 以上のとき：これは直前に3つ以上の連続する改行があったことを示し、複数の空行があったことを示します。
 
 // この変数は、特に `-n`, `-b`, `-s` オプションが有効なときに重要となります。これらのオプションはそれぞれ行番号の表示、非空白行に対する行番号の表示、連続する空行の圧縮を制御するためのものです。これらのオプションが有効なとき、`newlines` の値に基づいてどのような処理を行うかが決まります。
-    int newlines = newlines2;
+    int newlines = stdout_ctx.newlines;
 // これは、プログラムが FIONREAD ioctl を使用して最適化を行うべきかどうかを示すフラグです。
 #ifdef FIONREAD
     /* 非ゼロの場合(true)、最適化としてFIONREAD ioctlを使用します。
@@ -279,13 +2609,14 @@ cat(
     eob = inbuf;//eobは入力バッファの先頭にセットされる
     bpin = eob + 1;//入力バッファが現時点では空を示す。bpin > eobとなる。こうなることで、最初のループの評価時にバッファが空であると判断させることができる。これにより、すぐに新たな入力の読み込みが行われる
 
+    perf_reset();
+
     bpout = outbuf;//出力バッファの現在の書き込み位置が出力バッファの先頭にセットされる。これにより、最初の書き込みが出力バッファの先頭から始まるようになる。書き込み操作がバッファの先頭から開始されるようにする
 
     while (true) {
         // 無限ループ
-        do {
-            /* OUTBUFにOUTSIZE以上のバイトがあれば書き込む。 */
-        // ２a出力バッファが満タンになったときにその内容を出力する処理
+        /* OUTBUFにOUTSIZE以上のバイトがあれば書き込む。 */
+    // ２a出力バッファが満タンになったときにその内容を出力する処理
 //         このコードブロックは、出力バッファが一杯になった場合（`outbuf + outsize <= bpout`）に実行されます。出力バッファが一杯になったというのは、つまり、出力バッファに書き込まれたデータのサイズが、バッファのサイズ（`outsize`）を超えた場合を指します。
 
 // この場合、次の操作が実行されます：
@@ -303,18 +2634,22 @@ cat(
 // 6. 最後に、出力ポインタ（`bpout`）は、新しく書き込むべき位置、つまり移動されたデータの末尾に設定されます。
 
 // このコードブロックの主な目的は、バッファが一杯になったときにデータを書き込み、バッファをクリアすることで、次のデータの書き込みを可能にすることです。
-            if (outbuf + outsize <= bpout) {
-                // この判定はポインタとバッファサイズの操作に基づいています。
+        if (outbuf + outsize <= bpout) {
+            perf_mark(PERF_FORMAT);
+            // この判定はポインタとバッファサイズの操作に基づいています。
 
 // `outbuf`は出力バッファの先頭を指すポインタで、`outsize`はバッファの大きさ（容量）を表す値です。`bpout`は出力バッファ内の「次に書き込むべき位置」を指すポインタです。したがって、`bpout`が`outbuf + outsize`（バッファの先頭 + バッファのサイズ = バッファの末尾）に達するということは、出力バッファが一杯になったということを意味します。
 
 // 具体的には、`bpout`が`outbuf`から`outsize`バイト以上先に進んだ場合、つまり`outbuf + outsize <= bpout`となった場合、バッファは一杯で、新たなデータの書き込みがバッファのサイズを超えると判断されます。これは、`bpout`が「次に書き込むべき位置」を指しているため、`bpout`がバッファの末尾を超えるということは、すでにバッファが一杯であるということを意味します。
-                char *wp = outbuf;//wp書き込みポインタ
-                size_t remaining_bytes;
-                do {
-                    if (full_write(STDOUT_FILENO, wp, outsize) != outsize)
-                        die(EXIT_FAILURE, errno, _("write error"));
-                    wp += outsize;
+            char *wp = outbuf;//wp書き込みポインタ
+            size_t remaining_bytes;
+            do {
+                xtime_t start = stats_clock();
+                if (full_write(STDOUT_FILENO, wp, outsize) != outsize)
+                    die(EXIT_FAILURE, errno, _("write error"));
+                stats_write(outsize, start);
+                nocache_output(outsize);
+                wp += outsize;
 
 //                     `remaining_bytes = bpout - wp;` この式はポインタの差分を取る操作です。`bpout`は出力バッファ内の「次に書き込むべき位置」を指すポインタで、`wp`は現在書き込んでいる位置を指すポインタです。
 
@@ -323,185 +2658,1090 @@ cat(
 // ポインタ同士の減算操作は、そのポインタが指すデータ型の単位で差分を計算します。この場合、`char`型ポインタなので、`bpout - wp`は「`bpout`が指す場所から`wp`が指す場所までの`char`型データの数」を表します。これはバイト単位での差分と等しくなります。
 
 // 具体的には、`wp`がバッファの先頭を指し、`bpout`がその先の何かの位置を指している場合、`remaining_bytes = bpout - wp;`は`bpout`と`wp`の間にあるバイト数を計算します。
-                } while (outsize <= remaining_bytes);
+                remaining_bytes = bpout - wp;
+            } while (outsize <= remaining_bytes);
 
-                /* 残りのバイトをバッファの先頭に移動させる。
+            /* 残りのバイトをバッファの先頭に移動させる。
 バッファの先頭に移動させます。 */
 
-                memmove(outbuf, wp, remaining_bytes);
-                bpout = outbuf + remaining_bytes;
-            }
+            memmove(outbuf, wp, remaining_bytes);
+            bpout = outbuf + remaining_bytes;
+            perf_mark(PERF_FLUSH);
+        }
 
-            /* Is INBUF empty?  */
-            // 2b　入力バッファが空になったときに新たな内容を読み込む処理
-            if (bpin > eob) {
-                // このコードでは、`bpin`が指す場所が`eob`（End of Buffer）を超えているかどうかをチェックしています。具体的には、入力バッファから読み取るべき新たなデータがない（すべて読み取り終わった）ことを示しています。
+        /* Is INBUF empty?  */
+        // 2b　入力バッファが空になったときに新たな内容を読み込む処理
+        if (bpin > eob) {
+            perf_mark(PERF_FORMAT);
+            // このコードでは、`bpin`が指す場所が`eob`（End of Buffer）を超えているかどうかをチェックしています。具体的には、入力バッファから読み取るべき新たなデータがない（すべて読み取り終わった）ことを示しています。
 
 // `bpin`は"Buffer Pointer for INput"の略で、入力バッファの現在の読み取り位置を指しています。一方、`eob`は"End Of Buffer"の略で、入力バッファの終端を指しています。したがって、`bpin > eob`という条件は「現在の読み取り位置がバッファの終端を超えているか？」ということを確認しています。
 
 // もし`bpin > eob`が真であれば、それは入力バッファ内の現在のデータをすべて読み終わった（あるいはまだ何も読んでいない）、つまり新たなデータを読み込む必要があるという状態を意味します。これにより、次のデータ読み取りを準備するための`input_pending`フラグが`false`に設定されます。
-                bool input_pending = false;
+            bool input_pending = false;
 #ifdef FIONREAD
 // FIONREADが利用可能な環境では、これにより未読データが存在する場合のみ読み取り操作を行い、それ以外の場合には不要な読み取り操作を避けることが可能になり、プログラムのパフォーマンスを向上させることができます。ただし、FIONREADがサポートされていない環境や、特定のエラーが発生した場合には、この方法を使用しないようにコードが設計されています。
-                int n_to_read = 0;
+            int n_to_read = 0;
 
-            /* すぐに読むべき入力があるか？
+        /* すぐに読むべき入力があるか？
 ない場合は、これから待つことになります、 ので、待つ前にバッファリングされた出力をすべて書き込んでください。 */
 // use_fionread フラグが真である場合、FIONREAD ioctl を使って未読データのバイト数を n_to_read に取得しようとしています
-                if (use_fionread && ioctl(input_desc, FIONREAD, &n_to_read) < 0) {
-                    /* Ultrix は NFS で EOPNOTSUPP を返します；
-                       HP-UXはパイプでENOTTYを返します。
-                       SunOSはEINVALを返し
-                       More/BSDは/dev/nullのような特殊なファイルに対してENODEVを返します。
-                       のような特殊なファイルではENODEVを返す。
-                       Irix-5 はパイプで ENOSYS を返します。 */
-                    if (errno == EOPNOTSUPP || errno == ENOTTY || errno == EINVAL || errno == ENODEV || errno == ENOSYS)
-                        use_fionread = false;
-                    else {
-                        error(0, errno, _("cannot do ioctl on %s"),
-                              quoteaf(infile));
-                        newlines2 = newlines;
-                        return false;
-                    }
+            /* mmap や io_uring で読んでいる間は、入力は常にすぐ読める。
+               読むスレッドを使っているなら、読み終えたブロックを見る。 */
+            if (mmap_in.active || uring_in.active)
+                n_to_read = 1;
+            else if (ring_in.active)
+                n_to_read = ring_input_pending();
+            else if (use_fionread && ioctl(input_desc, FIONREAD, &n_to_read) < 0) {
+                /* Ultrix は NFS で EOPNOTSUPP を返します；
+                   HP-UXはパイプでENOTTYを返します。
+                   SunOSはEINVALを返し
+                   More/BSDは/dev/nullのような特殊なファイルに対してENODEVを返します。
+                   のような特殊なファイルではENODEVを返す。
+                   Irix-5 はパイプで ENOSYS を返します。 */
+                if (errno == EOPNOTSUPP || errno == ENOTTY || errno == EINVAL || errno == ENODEV || errno == ENOSYS)
+                    use_fionread = false;
+                else {
+                    error(0, errno, _("cannot do ioctl on %s"),
+                          quoteaf(infile));
+                    stdout_ctx.newlines = newlines;
+                    return false;
                 }
-                if (n_to_read != 0) {
+            }
+            if (n_to_read != 0) {
 // 未読データがあれば、後続の処理で未読データがあることをわかるようにするためにフラグをたてる
-                    input_pending = true;
-                }
+                input_pending = true;
+            }
+            stats_refill(input_pending);
 #endif
-
-                if (!input_pending)
-                //保留中のデータをすべて書き込む外部の非標準ヘルパー
-                    write_pending(outbuf, &bpout);
-
-                /* INBUFにさらに入力を読み込む。 */
-                // 末尾処理: 最後に、ファイルの終端に達したときやエラーが発生したときの処理を行っています。具体的には、バッファに残ったデータの出力とエラーメッセージの表示が行われます。
-                n_read = safe_read(input_desc, inbuf, insize);
-                if (n_read == SAFE_READ_ERROR) {
-                    // エラー発生
-                    error(0, errno, "%s", quotef(infile));
-                    write_pending(outbuf, &bpout);
-                    newlines2 = newlines;
-                    return false;
+            perf_mark(PERF_REFILL);
+
+            if (!input_pending)
+            //保留中のデータをすべて書き込む外部の非標準ヘルパー
+                write_pending(outbuf, &bpout);
+
+            /* --writev の出力は入力のバッファを指しているので、読み足す前に
+               書き出す。 */
+            if (gather.active)
+                gather_flush();
+            perf_mark(PERF_FLUSH);
+
+            /* INBUFにさらに入力を読み込む。 */
+            // 末尾処理: 最後に、ファイルの終端に達したときやエラーが発生したときの処理を行っています。具体的には、バッファに残ったデータの出力とエラーメッセージの表示が行われます。
+            xtime_t start = stats_clock();
+            n_read = fill_input(inbuf, insize, &bpin, &eob);
+            stats_read(n_read, start);
+            perf_mark(PERF_REFILL);
+            if (n_read == SAFE_READ_ERROR) {
+                // エラー発生
+                error(0, errno, "%s", quotef(infile));
+                write_pending(outbuf, &bpout);
+                perf_mark(PERF_FLUSH);
+                stdout_ctx.newlines = newlines;
+                return false;
+            }
+            if (n_read == 0) {
+                // EOFに達した
+                write_pending(outbuf, &bpout);
+                perf_mark(PERF_FLUSH);
+                stdout_ctx.newlines = newlines;
+                return true;
+            }
+            perf_bytes(n_read);
+
+/* ポインターの更新とバッファエンドのセンチネルは fill_input() が行う。
+   mmap で読んでいるときは、bpin はマッピングの中を指し、センチネルは
+   ファイル中の改行そのものになる。 */
+
+            /* 整形しても何も変わらない大きなブロックは、outbuf に写さずに
+               入力のバッファからそのまま書き出す。 行頭なら行番号だけを
+               先に出す。 mmap のブロックは前のブロックの番兵だった改行で
+               始まるので、先頭の改行は除いて調べ、それだけを番兵付きの
+               別のバッファで整形する。 */
+            char *unchanged = bpin + (*bpin == '\n' && bpin < eob);
+            if (PASS_THROUGH_MIN <= n_read && !gather.active
+                && format_unchanged(unchanged, eob, stdout_ctx.options)) {
+                if (unchanged != bpin) {
+                    char nl[2] = {'\n', '\n'};
+                    char *p = nl;
+                    bpout = stdout_ctx.format(&p, nl + 1, bpout,
+                                              outbuf + outsize, &newlines,
+                                              &stdout_ctx.lc);
                 }
-                if (n_read == 0) {
-                    // EOFに達した
-                    write_pending(outbuf, &bpout);
-                    newlines2 = newlines;
-                    return true;
+                if (newlines >= 0 && (options & CAT_NUMBER)) {
+                    next_line_num(&stdout_ctx.lc);
+                    bpout = line_counter_put(&stdout_ctx.lc, bpout);
                 }
+                perf_mark(PERF_FORMAT);
+                write_pending(outbuf, &bpout);
+                char *end = eob;
+                write_pending(unchanged, &end);
+                perf_mark(PERF_FLUSH);
+                /* 行に関わるオプションがあれば改行を含まないので、行の途中
+                   になる。 そうでなければ newlines は使わない。 */
+                newlines = -1;
+                bpin = eob + 1;
+                continue;
+            }
+        }
+
+        /* 次の番兵を読むか、出力バッファが埋まるまで整形する。 */
+        if (gather.active)
+            gather_lines(&bpin, eob, &newlines, &stdout_ctx.lc, options);
+        else
+            bpout = stdout_ctx.format(&bpin, eob, bpout, outbuf + outsize,
+                                      &newlines, &stdout_ctx.lc);
+    }
+}
 
-/* ポインターを更新し、バッファエンドにセンチネルを挿入します。 */
-// bpin = inbuf; eob = bpin + n_read; *eob = '\n'; これらの行では、バッファ内の新たなデータの位置を設定し、バッファの終端にセンチネル（終端を表す特殊な値）として改行文字を挿入しています。これにより、バッファの終端を明示的に示すことで、バッファオーバーフロー（バッファの範囲を超えたアクセス）を防ぐことができます。
+/* OPTIONS を "-nbsETv" の形で BUF に書いて返す。 */
+static char *
+option_string(unsigned int options, char *buf) {
+    static char const letters[] = "nbsETv";  /* CAT_* のビットの順 */
+    char *p = buf;
+    *p++ = '-';
+    for (int i = 0; letters[i]; i++)
+        if (options & 1u << i)
+            *p++ = letters[i];
+    *p = '\0';
+    return buf;
+}
 
-                bpin = inbuf;
-                eob = bpin + n_read;
-                *eob = '\n';
-            } else {
-                /* 本物の（センチネルではない）改行でした。 */
-                /* 最後の行は空でしたか？
-                   (つまり、2つ以上の連続した改行が読み込まれたか) */
-//todo ３．改行文字の処理　行番号の出力や連続する空行の圧縮などが行われます
-                if (++newlines > 0) {
-                    if (newlines >= 2) {
-                        /* ここでは2個までとする。 そうでないと、連続した改行が多い場合 連続した改行があると、カウンターはINT_MAXで折り返すことができます。 */
-                        /* 複数の隣接する空行を同上(-s)で置換する場合、この空行は2行目だったのでしょうか？ */
-                        if (squeeze_blank) {
-                            ch = *bpin++;
-                            continue;
-                        }
-                    }
+/* ---microbench: 整形の核を、システムコールを挟まずにメモリ上の
+   バッファで測る。 開発用で、--help には出さない。 */
+static bool microbench;
 
-                    /* 空行(-n)に行番号を書きますか？ */
+/* 測る入力の大きさと、一番速い回を取るための繰り返しの回数。 */
+enum { MICROBENCH_SIZE = 16 * 1024 * 1024, MICROBENCH_REPEAT = 5 };
 
-                    if (number && !number_nonblank) {
-                        next_line_num();//行番号バッファを更新する。
-                        bpout = stpcpy(bpout, line_num_print);
-                    }
-                }
+/* 測る入力の一番長い行。 出力のバッファは、これを整形した分だけ
+   余分に取る。 */
+enum { MICROBENCH_LINE_MAX = 256 };
 
-                /* (-e).$を出力  */
+/* next_line_num() を桁が増える境目をまたいで続けて呼ぶ回数。 1回だけ
+   では、時刻を読む時間に埋もれてしまう。 */
+enum { MICROBENCH_BATCH = 16 };
 
-                if (show_ends)
-                    *bpout++ = '$';
+/* 時刻。 x86 ではタイムスタンプカウンタのサイクル、ほかではナノ秒。 */
+#if defined __x86_64__ && defined __GNUC__
+# define MICROBENCH_UNIT "cycles"
+static inline uint64_t
+microbench_clock(void) {
+    return __rdtsc();
+}
+#else
+# define MICROBENCH_UNIT "ns"
+static inline uint64_t
+microbench_clock(void) {
+    return gethrxtime();
+}
+#endif
 
-                /* 改行を出力.  */
+/* 短い行、空行、タブ、制御文字、上位ビットの立ったバイトが混ざった
+   入力を BUF に LEN バイト作る。 BUF[LEN] は番兵の改行にする。 */
+static void
+microbench_input(char *buf, size_t len) {
+    uint32_t x = 2463534242;
+    char *p = buf, *end = buf + len;
+    while (p < end) {
+        x ^= x << 13, x ^= x >> 17, x ^= x << 5;
+        size_t n = x % 8 == 0 ? 0 : x % MICROBENCH_LINE_MAX;
+        for (size_t i = 0; i < n && p < end - 1; i++) {
+            x ^= x << 13, x ^= x >> 17, x ^= x << 5;
+            unsigned r = x % 64;
+            *p++ = (r == 0 ? '\t' : r == 1 ? x >> 8 & 0x1f
+                    : r == 2 ? 0x80 | (x >> 8 & 0x7f) : 'a' + r % 26);
+        }
+        *p++ = '\n';
+    }
+    buf[len] = '\n';
+}
 
-                *bpout++ = '\n';
+/* format_lines_select() が選ぶオプションの組すべてについて format_lines()
+   の1バイトあたりの時間を、桁の繰り上がりごとに、そこをまたぐ
+   next_line_num() の1回あたりの時間を標準出力に出す。 */
+static int
+microbench_run(void) {
+    size_t outsize = IO_BUFSIZE;
+    char *in = xmalloc(MICROBENCH_SIZE + 1);
+    char *out = xmalloc(outsize + MICROBENCH_LINE_MAX * 4
+                        + LINE_COUNTER_BUF_LEN + 2);
+    microbench_input(in, MICROBENCH_SIZE);
+
+    /* CAT_NUMBER_NONBLANK は CAT_NUMBER といっしょにしか立たない。 */
+    for (unsigned int o = 0; o <= CAT_OPTIONS; o++) {
+        if ((o & CAT_NUMBER_NONBLANK) && !(o & CAT_NUMBER))
+            continue;
+        format_lines_fn *format = format_lines_select(o);
+        uint64_t best = UINT64_MAX;
+        uintmax_t out_bytes = 0;
+        for (int r = 0; r < MICROBENCH_REPEAT; r++) {
+            struct line_counter lc = LINE_COUNTER_INITIALIZER;
+            int newlines = 0;
+            char *bpin = in;
+            char *eob = in + MICROBENCH_SIZE;
+            out_bytes = 0;
+
+            uint64_t start = microbench_clock();
+            /* 出力が埋まるたびに捨てて、番兵まで整形する。 */
+            while (bpin <= eob) {
+                char *bpout = format(&bpin, eob, out, out + outsize,
+                                     &newlines, &lc);
+                out_bytes += bpout - out;
             }
-            ch = *bpin++;
-        } while (ch == '\n');//chは最後に入力バッファから読み取った１文字。したがって、読み取ったものが改行文字の間繰り返す
+            uint64_t elapsed = microbench_clock() - start;
+            best = MIN(best, elapsed);
+        }
+        char name[sizeof "-nbsETv"];
+        printf("format_lines %-8s %8.3f %s/byte  (%ju bytes out)\n",
+               option_string(o, name), (double) best / MICROBENCH_SIZE,
+               MICROBENCH_UNIT, out_bytes);
+    }
 
-        /* 行頭であり、行番号が要求されているか？ */
-        // newlinesは最後に読み込んだ文字が改行であるかどうかを示す変数。改行が連続で出現した場合、この値はそれらの連続する改行の数になります。最後に読み込んだ文字が改行でなければ、この値は-1になります。したがって、newlines >= 0は新しい行が始まったという状態を示す
-        if (newlines >= 0 && number) {
-            next_line_num();
-            // line_num_printは出力するべき行番号を格納した文字列の開始位置を指すポインタ.next_line_num()によって更新され、最新の行番号を常に保持
-            bpout = stpcpy(bpout, line_num_print);
-            // bpoutは出力バッファの現在のいちを指すポインタ。line_num_printが指す文字列（行番号）をbpoutが指す位置にコピーし、その後、コピーした文字列の末尾のいちを返します。その結果bpoutは更新され、次の出力は行番号の直後から開始される
+    /* 時刻を2回読むだけの時間。 下の境目の時間から引く。 */
+    uint64_t overhead = UINT64_MAX;
+    for (int r = 0; r < 1000; r++) {
+        uint64_t t = microbench_clock();
+        overhead = MIN(overhead, microbench_clock() - t);
+    }
+    printf("clock overhead %8ju %s\n", (uintmax_t) overhead, MICROBENCH_UNIT);
+
+    /* 普通に数えていく1回と、桁が増える境目をまたぐ1回。 */
+    enum { CALLS = 1000000 };
+    struct line_counter lc = LINE_COUNTER_INITIALIZER;
+    uint64_t start = microbench_clock();
+    for (int i = 0; i < CALLS; i++)
+        next_line_num(&lc);
+    printf("next_line_num 1..%d %8.3f %s/call\n", CALLS,
+           (double) (microbench_clock() - start) / CALLS, MICROBENCH_UNIT);
+
+    for (uintmax_t boundary = 9; boundary < UINTMAX_MAX / 10;
+         boundary = boundary * 10 + 9) {
+        uintmax_t first = boundary - MICROBENCH_BATCH / 2;
+        uint64_t best = UINT64_MAX;
+        for (int r = 0; r < 1000; r++) {
+            line_counter_set(&lc, first);
+            uint64_t t = microbench_clock();
+            for (int i = 0; i < MICROBENCH_BATCH; i++)
+                next_line_num(&lc);
+            best = MIN(best, microbench_clock() - t);
+        }
+        printf("next_line_num %ju..%ju %8.3f %s/call\n", first + 1,
+               line_counter_value(&lc),
+               (double) (best - MIN(best, overhead)) / MICROBENCH_BATCH,
+               MICROBENCH_UNIT);
+    }
+
+    free(in);
+    free(out);
+    return EXIT_SUCCESS;
+}
+
+/* ---fuzz=N[:SEED]: 整形の関数、cat_feed()、入力の読み方ごとの経路が、
+   1バイトずつ整形する基準の実装と同じ出力を出すかを、乱数で作った入力で
+   確かめる。 開発用で、--help には出さない。 */
+static bool fuzz;
+static uintmax_t fuzz_iterations = 100;
+static uint64_t fuzz_seed;
+
+/* 比べる読み方。 比の基準は最初のもの。 */
+static char const *const fuzz_engines[] = {
+    "--io-engine=read",
+    "--io-engine=auto",
+    "--io-engine=mmap",
+    "--io-engine=io_uring",
+    "--ring-depth=3",
+    "--writev",
+    "--parallel=3",
+    "--prefetch=8",
+    "--direct",
+    "--nocache",
+    "--huge-pages",
+    "--adaptive-io=4K:64K"
+};
+
+enum { FUZZ_ENGINES = sizeof fuzz_engines / sizeof *fuzz_engines };
+
+/* 1回に渡すファイルの数の上限と、1つのファイルの大きさの上限。 */
+enum { FUZZ_FILES = 4, FUZZ_FILE_MAX = 4 * 1024 * 1024 };
+
+static uint64_t
+fuzz_random(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+/* 空行の続き、タブ、制御文字、上位ビットの立ったバイト、読み込みの
+   大きさを超える長い行、最後に改行のない行が混ざった入力を作る。 */
+static char *
+fuzz_input(uint64_t *rng, size_t *lenp) {
+    size_t max = (size_t) 1 << fuzz_random(rng) % 23;
+    size_t len = fuzz_random(rng) % MIN(max, FUZZ_FILE_MAX);
+    char *buf = xmalloc(len + 1);
+
+    for (size_t i = 0; i < len;) {
+        uint64_t r = fuzz_random(rng);
+        size_t run = MIN(len - i, 1 + (r >> 8) % (r % 16 == 0 ? 300000 : 100));
+        for (size_t j = 0; j < run; j++) {
+            uint64_t c = fuzz_random(rng);
+            switch (r % 8) {
+                case 0:
+                    buf[i + j] = '\n';
+                    break;
+                case 1:
+                    buf[i + j] = c % 4 ? '\t' : '\n';
+                    break;
+                case 2:
+                    buf[i + j] = c;
+                    break;
+                case 3:
+                    buf[i + j] = c % 2 ? 0x80 | c >> 8 : c >> 8 & 0x1f;
+                    break;
+                default:
+                    buf[i + j] = c % 40 ? 'a' + c % 26 : '\n';
+                    break;
+            }
+        }
+        i += run;
+    }
+    *lenp = len;
+    return buf;
+}
+
+/* line_counter_set() で飛ばした行番号が、next_line_num() で1つずつ
+   進めたものと同じかを、乱数で選んだ幅、最初の値、増分で、桁の
+   繰り上がりと uintmax_t の溢れの前後で確かめる。 */
+static bool
+fuzz_line_counter(uint64_t *rng) {
+    for (int i = 0; i < 100000; i++) {
+        uintmax_t n = 1;
+        for (int d = fuzz_random(rng) % 20; d; d--)
+            n *= 10;
+        uintmax_t back = fuzz_random(rng) % 4;
+        if (back < n)
+            n -= back;
+        if (fuzz_random(rng) % 2)
+            n += fuzz_random(rng) % 1000;
+
+        struct line_counter a = LINE_COUNTER_INITIALIZER;
+        if (fuzz_random(rng) % 2) {
+            uintmax_t start = fuzz_random(rng) % 3 ? fuzz_random(rng) % 1000
+                              : UINTMAX_MAX - fuzz_random(rng) % 1000;
+            uintmax_t increment = fuzz_random(rng) % 3 ? fuzz_random(rng) % 150
+                                  : fuzz_random(rng);
+            line_counter_init(&a, 1 + fuzz_random(rng) % LINE_COUNTER_FIELD,
+                              start, increment, ": ");
+            n = MIN(n, UINTMAX_MAX - 1);
+        }
+        struct line_counter b = a;
+        line_counter_set(&a, n);
+        next_line_num(&a);
+        line_counter_set(&b, n + 1);
+        if (a.len != b.len
+            || memcmp(a.buf + a.print, b.buf + b.print, a.len) != 0) {
+            error(0, 0, _("line number %ju+1 is '%.*s', expected '%.*s'"),
+                  n, (int) a.len, a.buf + a.print, (int) b.len,
+                  b.buf + b.print);
+            return false;
+        }
+    }
+    return true;
+}
+
+/* 出力を入れる伸びるバッファ。 */
+struct fuzz_output {
+    char *buf;
+    size_t len;
+    size_t alloc;
+};
+
+/* OUT の後ろに P から N バイトを足す。 */
+static void
+fuzz_append(struct fuzz_output *out, char const *p, size_t n) {
+    while (out->alloc - out->len < n)
+        out->buf = x2realloc(out->buf, &out->alloc);
+    memcpy(out->buf + out->len, p, n);
+    out->len += n;
+}
+
+/* 基準の整形の状態。 行番号は snprintf で作る。 */
+struct fuzz_reference {
+    unsigned int options;  /* CAT_* の論理和 */
+    int newlines;          /* struct cat_ctx の newlines と同じ */
+    uintmax_t lines;       /* これまでに振った行番号の数 */
+    unsigned int width;
+    uintmax_t start;
+    uintmax_t increment;
+    char const *sep;
+};
+
+#define FUZZ_REFERENCE_INITIALIZER(options) {(options), 0, 0, 6, 1, 1, "\t"}
+
+/* IN から LEN バイトを、もとの cat() のループと同じく1バイトずつ整形して
+   OUT に足す。 表も SIMD もまとめての処理も使わないので、整形の関数と
+   cat() の速い経路を確かめる基準になる。 行番号は溢れないものとする。 */
+static void
+fuzz_reference(struct fuzz_reference *r, char const *in, size_t len,
+               struct fuzz_output *out) {
+    bool number = r->options & CAT_NUMBER;
+    bool number_nonblank = r->options & CAT_NUMBER_NONBLANK;
+    bool squeeze_blank = r->options & CAT_SQUEEZE_BLANK;
+    bool show_ends = r->options & CAT_SHOW_ENDS;
+    bool show_tabs = r->options & CAT_SHOW_TABS;
+    bool show_nonprinting = r->options & CAT_SHOW_NONPRINTING;
+
+    for (size_t i = 0; i < len; i++) {
+        unsigned char ch = in[i];
+        char buf[64];
+        int n = 0;
+
+        if (ch == '\n') {
+            if (++r->newlines > 0) {
+                if (r->newlines >= 2) {
+                    r->newlines = 2;
+                    if (squeeze_blank)
+                        continue;
+                }
+                if (number && !number_nonblank)
+                    n = snprintf(buf, sizeof buf, "%*ju%s", (int) r->width,
+                                 r->start + r->lines++ * r->increment, r->sep);
+            }
+            if (show_ends)
+                buf[n++] = '$';
+            buf[n++] = '\n';
+            fuzz_append(out, buf, n);
+            continue;
         }
 
-        /* ここでCHは改行文字を含むことができません。 */
+        if (r->newlines >= 0 && number)
+            n = snprintf(buf, sizeof buf, "%*ju%s", (int) r->width,
+                         r->start + r->lines++ * r->increment, r->sep);
+        r->newlines = -1;
 
-        /* バッファが空になったか、適切な改行が見つかったことを意味する改行文字が見つかるまでは、以下のループが続きます。 */
-        /* quoting、すなわち-v、-e、-tのうち少なくとも1つが指定されている場合、 変換が必要な文字列をスキャンします。 */
-        //    4非印刷文字の処理: この部分では、読み込んだ文字が非印刷文字（制御文字やASCII範囲外の文字）だった場合の処理を行っています。具体的には、これらの文字を可視化するための変換が行われます。
         if (show_nonprinting) {
-            while (true) {
-                if (ch >= 32) {
-                    // 特殊文字ではなくて
-                    if (ch < 127)
-                    // asciiにある文字なら
-                        *bpout++ = ch;
-                    else if (ch == 127) {
-                        // DELなら
-                        *bpout++ = '^';
-                        *bpout++ = '?';
-                    } else {
-                        // asciiの表にないなら
-                        *bpout++ = 'M';
-                        *bpout++ = '-';
-                        if (ch >= 128 + 32) {
-                            if (ch < 128 + 127)
-                                *bpout++ = ch - 128;
-                            else {
-                                *bpout++ = '^';
-                                *bpout++ = '?';
-                            }
-                        } else {
-                            *bpout++ = '^';
-                            *bpout++ = ch - 128 + 64;
+            if (ch >= 32) {
+                if (ch < 127)
+                    buf[n++] = ch;
+                else if (ch == 127) {
+                    buf[n++] = '^';
+                    buf[n++] = '?';
+                } else {
+                    buf[n++] = 'M';
+                    buf[n++] = '-';
+                    if (ch >= 128 + 32) {
+                        if (ch < 128 + 127)
+                            buf[n++] = ch - 128;
+                        else {
+                            buf[n++] = '^';
+                            buf[n++] = '?';
                         }
+                    } else {
+                        buf[n++] = '^';
+                        buf[n++] = ch - 128 + 64;
                     }
-                } else if (ch == '\t' && !show_tabs)
-                    *bpout++ = '\t';
-                else if (ch == '\n') {
-                    newlines = -1;
-                    break;
-                } else {
-                    *bpout++ = '^';
-                    *bpout++ = ch + 64;//@:64,A:65~なので、0-31の範囲の制御文字を対応する64-95の範囲の大文字アルファベットといくつかの記号にマッピングするためのテクニック
                 }
-
-                ch = *bpin++;
+            } else if (ch == '\t' && !show_tabs)
+                buf[n++] = '\t';
+            else {
+                buf[n++] = '^';
+                buf[n++] = ch + 64;
             }
-        } else {
-            /* -v, -e, -tのいずれも指定されておらず、引用されていない。 */
-            while (true) {
-                if (ch == '\t' && show_tabs) {
-                    *bpout++ = '^';
-                    *bpout++ = ch + 64;//&\t':9 I:73
-                } else if (ch != '\n')
-                    *bpout++ = ch;
-                else {
-                    newlines = -1;
-                    break;
+        } else if (ch == '\t' && show_tabs) {
+            buf[n++] = '^';
+            buf[n++] = 'I';
+        } else
+            buf[n++] = ch;
+        fuzz_append(out, buf, n);
+    }
+}
+
+/* 乱数で作った入力を、オプションの組すべてについて format_lines_select()
+   の整形の関数で整形し、fuzz_reference() と比べる。 cat() と同じように、
+   乱数で決めた大きさに切った入力を番兵の付いたバッファに入れ、乱数で
+   決めた大きさの出力のバッファが埋まるか、ときどきブロックの終わりで
+   書き出す。 行番号の幅、最初の値、増分、区切りも乱数で選ぶ。 食い違えば
+   入力を SAVE に残して false を返す。 */
+static bool
+fuzz_format(uint64_t *rng, char const *save) {
+    static char const *const seps[] = {"\t", ": ", "", "12345678"};
+    size_t len;
+    char *in = fuzz_input(rng, &len);
+    struct fuzz_output expect = {NULL, 0, 0}, got = {NULL, 0, 0};
+    bool ok = true;
+
+    for (unsigned int o = 0; ok && o <= CAT_OPTIONS; o++) {
+        unsigned int options = (o & CAT_NUMBER_NONBLANK ? o | CAT_NUMBER : o);
+        struct fuzz_reference r = FUZZ_REFERENCE_INITIALIZER(options);
+        struct line_counter lc = LINE_COUNTER_INITIALIZER;
+        if (fuzz_random(rng) % 2) {
+            r.width = 1 + fuzz_random(rng) % LINE_COUNTER_FIELD;
+            r.start = fuzz_random(rng) % 1000;
+            r.increment = fuzz_random(rng) % 150;
+            r.sep = seps[fuzz_random(rng) % (sizeof seps / sizeof *seps)];
+            line_counter_init(&lc, r.width, r.start, r.increment, r.sep);
+        }
+        expect.len = 0;
+        fuzz_reference(&r, in, len, &expect);
+
+        size_t insize = 1 + fuzz_random(rng) % (fuzz_random(rng) % 2
+                                                ? 64 : 128 * 1024);
+        size_t outsize = 1 + fuzz_random(rng) % (fuzz_random(rng) % 2
+                                                 ? 64 : 128 * 1024);
+        char *inbuf = xmalloc(insize + 1);
+        char *outbuf = xmalloc(outsize - 1 + insize * 4 + LINE_COUNTER_BUF_LEN);
+        char *bpout = outbuf;
+        format_lines_fn *format = format_lines_select(options);
+        int newlines = 0;
+
+        got.len = 0;
+        for (size_t i = 0; i < len;) {
+            size_t n = 1 + fuzz_random(rng) % insize;
+            n = MIN(n, len - i);
+            memcpy(inbuf, in + i, n);
+            i += n;
+            char *bpin = inbuf;
+            char *eob = inbuf + n;
+            *eob = '\n';
+            while (bpin <= eob) {
+                bpout = format(&bpin, eob, bpout, outbuf + outsize, &newlines,
+                               &lc);
+                if (outbuf + outsize <= bpout) {
+                    fuzz_append(&got, outbuf, bpout - outbuf);
+                    bpout = outbuf;
                 }
+            }
+            if (fuzz_random(rng) % 2) {
+                fuzz_append(&got, outbuf, bpout - outbuf);
+                bpout = outbuf;
+            }
+        }
+        fuzz_append(&got, outbuf, bpout - outbuf);
+        free(inbuf);
+        free(outbuf);
+
+        if (got.len != expect.len || memcmp(got.buf, expect.buf, got.len) != 0) {
+            size_t at = 0;
+            while (at < MIN(got.len, expect.len) && got.buf[at] == expect.buf[at])
+                at++;
+            char optstr[sizeof "-nbsETv"];
+            int fd = open(save, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+            if (0 <= fd) {
+                full_write(fd, in, len);
+                close(fd);
+            }
+            error(0, 0, _("format_lines %s differs from the reference at "
+                          "byte %zu (%zu/%zu bytes; %zu-byte blocks, "
+                          "%zu-byte output buffer; numbers %u wide from %ju "
+                          "by %ju); input kept in %s"),
+                  option_string(options, optstr), at, got.len,
+                  expect.len, insize, outsize, r.width, r.start, r.increment,
+                  quotef(save));
+            ok = false;
+        }
+    }
+
+    free(in);
+    free(expect.buf);
+    free(got.buf);
+    return ok;
+}
+
+/* fuzz_feed() の出力の受け取り手。 OUT に足していき、合わせて BUDGET
+   バイトを超える出力を渡されたら失敗する。 失敗した後にまた渡されたら
+   LATE を立てる。 */
+struct fuzz_sink {
+    struct fuzz_output out;
+    size_t budget;
+    bool failed;
+    bool late;
+};
+
+static bool
+fuzz_sink_write(void *arg, char const *buf, size_t len) {
+    struct fuzz_sink *sink = arg;
+    sink->late |= sink->failed;
+    if (sink->budget - sink->out.len < len) {
+        sink->failed = true;
+        return false;
+    }
+    fuzz_append(&sink->out, buf, len);
+    return true;
+}
+
+/* cat_feed() と cat_finish() を確かめる。 乱数で選んだオプションと
+   行番号の形で2つの struct cat_ctx を作り、それぞれの入力を乱数で
+   決めた大きさに切って、交互に乱数で選んだ順に渡す。 出力が
+   fuzz_reference() と同じか、cat_finish() の後にもう一度渡すと同じ出力に
+   なるかを調べる。 ときどき受け取り手に途中で失敗させ、cat_feed() が
+   false を返して、それより後を渡さないことと、それまでの出力が正しい
+   ことを調べる。 食い違えば
+   その入力を SAVE に残して false を返す。 */
+static bool
+fuzz_feed(uint64_t *rng, char const *save) {
+    static char const *const seps[] = {"\t", ": ", "", "12345678"};
+    struct {
+        char *in;
+        size_t len;
+        size_t fed;
+        int passes;            /* 入力を何回渡すか */
+        int pass;              /* 渡し終えた回数 */
+        bool failed;           /* cat_feed() が false を返した */
+        struct cat_ctx ctx;
+        struct fuzz_reference r;
+        struct fuzz_sink sink;
+        struct fuzz_output expect;
+    } s[2];
+    bool ok = true;
+
+    for (int i = 0; i < 2; i++) {
+        unsigned int options = fuzz_random(rng) & CAT_OPTIONS;
+        if (options & CAT_NUMBER_NONBLANK)
+            options |= CAT_NUMBER;
+        s[i].in = fuzz_input(rng, &s[i].len);
+        s[i].fed = 0;
+        s[i].passes = 2 - i;
+        s[i].pass = 0;
+        s[i].failed = false;
+        cat_ctx_init(&s[i].ctx, options);
+        s[i].r = (struct fuzz_reference) FUZZ_REFERENCE_INITIALIZER(options);
+        if (fuzz_random(rng) % 2) {
+            s[i].r.width = 1 + fuzz_random(rng) % LINE_COUNTER_FIELD;
+            s[i].r.start = fuzz_random(rng) % 1000;
+            s[i].r.increment = fuzz_random(rng) % 150;
+            s[i].r.sep = seps[fuzz_random(rng) % (sizeof seps / sizeof *seps)];
+            cat_ctx_set_numbering(&s[i].ctx, s[i].r.width, s[i].r.start,
+                                  s[i].r.increment, s[i].r.sep);
+        }
+        s[i].expect = (struct fuzz_output) {NULL, 0, 0};
+        fuzz_reference(&s[i].r, s[i].in, s[i].len, &s[i].expect);
+        s[i].sink.out = (struct fuzz_output) {NULL, 0, 0};
+        s[i].sink.failed = s[i].sink.late = false;
+        size_t total = s[i].expect.len * s[i].passes;
+        s[i].sink.budget = (fuzz_random(rng) % 4 == 0
+                            ? fuzz_random(rng) % (total + 1) : SIZE_MAX);
+    }
+
+    /* 1つ目の入力を渡し終えたら cat_finish() して、もう一度渡す。 */
+    while (s[0].pass < s[0].passes || s[1].pass < s[1].passes) {
+        int i = fuzz_random(rng) % 2;
+        if (s[i].pass == s[i].passes)
+            i = !i;
+        size_t n = fuzz_random(rng) % (fuzz_random(rng) % 2 ? 64 : 64 * 1024);
+        n = MIN(n, s[i].len - s[i].fed);
+        struct cat_sink sink = {fuzz_sink_write, &s[i].sink};
+        if (!s[i].failed
+            && !cat_feed(&s[i].ctx, s[i].in + s[i].fed, n, &sink))
+            s[i].failed = true;
+        s[i].fed += n;
+        if (s[i].fed == s[i].len) {
+            s[i].pass++;
+            s[i].fed = 0;
+            if (s[i].pass < s[i].passes)
+                cat_finish(&s[i].ctx);
+        }
+    }
+
+    for (int i = 0; i < 2 && ok; i++) {
+        struct fuzz_output const *got = &s[i].sink.out;
+        struct fuzz_output const *expect = &s[i].expect;
+        size_t total = expect->len * s[i].passes;
+        bool fits = total <= s[i].sink.budget;
+        bool same = (got->len <= total
+                     && (s[i].failed || got->len == total));
+        for (size_t at = 0; same && at < got->len; at += expect->len)
+            same = memcmp(got->buf + at, expect->buf,
+                          MIN(expect->len, got->len - at)) == 0;
+        if (s[i].failed == fits || s[i].sink.late || !same) {
+            char optstr[sizeof "-nbsETv"];
+            int fd = open(save, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+            if (0 <= fd) {
+                full_write(fd, s[i].in, s[i].len);
+                close(fd);
+            }
+            error(0, 0, _("cat_feed %s on stream %d differs from the "
+                          "reference (%zu/%zu bytes, %zu-byte sink %s%s); "
+                          "input kept in %s"),
+                  option_string(s[i].ctx.options, optstr), i + 1,
+                  got->len, total, s[i].sink.budget,
+                  s[i].failed ? "failed" : "did not fail",
+                  s[i].sink.late ? " and was written to again" : "",
+                  quotef(save));
+            ok = false;
+        }
+    }
+
+    for (int i = 0; i < 2; i++) {
+        free(s[i].in);
+        free(s[i].expect.buf);
+        free(s[i].sink.out.buf);
+    }
+    return ok;
+}
 
-                ch = *bpin++;
+/* SELF を ARGV で走らせる。 標準入力には IN を CHUNKS の乱数で決めた
+   大きさに切って流し、標準出力は TO_PIPE ならパイプから、そうでなければ
+   OUTFILE から OUT に集める。 終了ステータスを返し、かかった時間を
+   *SECONDS に足す。 */
+static int
+fuzz_run(char const *self, char **argv, char const *in, size_t in_len,
+         uint64_t chunks, bool to_pipe, char const *outfile,
+         struct fuzz_output *out, double *seconds) {
+    int in_pipe[2], out_pipe[2] = {-1, -1};
+    if (pipe(in_pipe) != 0 || (to_pipe && pipe(out_pipe) != 0))
+        die(EXIT_FAILURE, errno, "pipe");
+    int outfd = to_pipe ? out_pipe[1]
+                        : open(outfile, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (outfd < 0)
+        die(EXIT_FAILURE, errno, "%s", quotef(outfile));
+
+    xtime_t start = gethrxtime();
+    pid_t pid = fork();
+    if (pid < 0)
+        die(EXIT_FAILURE, errno, "fork");
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        if (dup2(in_pipe[0], STDIN_FILENO) < 0
+            || dup2(outfd, STDOUT_FILENO) < 0
+            || dup2(null, STDERR_FILENO) < 0)
+            _exit(127);
+        close(in_pipe[1]);
+        if (to_pipe)
+            close(out_pipe[0]);
+        execv(self, argv);
+        _exit(127);
+    }
+
+    /* 標準入力は別のプロセスから流す。 こちらは出力を読み続ける。 */
+    pid_t feeder = fork();
+    if (feeder < 0)
+        die(EXIT_FAILURE, errno, "fork");
+    if (feeder == 0) {
+        close(in_pipe[0]);
+        if (to_pipe)
+            close(out_pipe[0]);
+        signal(SIGPIPE, SIG_IGN);
+        for (size_t i = 0; i < in_len;) {
+            size_t n = 1 + fuzz_random(&chunks) % 70000;
+            n = MIN(n, in_len - i);
+            if (full_write(in_pipe[1], in + i, n) != n)
+                break;
+            i += n;
+        }
+        _exit(0);
+    }
+    close(in_pipe[0]);
+    close(in_pipe[1]);
+    close(outfd);
+
+    out->len = 0;
+    if (to_pipe) {
+        while (true) {
+            if (out->alloc - out->len < 65536)
+                out->buf = x2realloc(out->buf, &out->alloc);
+            size_t n = safe_read(out_pipe[0], out->buf + out->len,
+                                 out->alloc - out->len);
+            if (n == SAFE_READ_ERROR)
+                die(EXIT_FAILURE, errno, "read");
+            if (n == 0)
+                break;
+            out->len += n;
+        }
+        close(out_pipe[0]);
+    }
+
+    int status;
+    waitpid(feeder, &status, 0);
+    while (waitpid(pid, &status, 0) < 0)
+        if (errno != EINTR)
+            die(EXIT_FAILURE, errno, "waitpid");
+    *seconds += (gethrxtime() - start) / 1e9;
+
+    if (!to_pipe) {
+        int fd = open(outfile, O_RDONLY);
+        if (fd < 0)
+            die(EXIT_FAILURE, errno, "%s", quotef(outfile));
+        while (true) {
+            if (out->alloc - out->len < 65536)
+                out->buf = x2realloc(out->buf, &out->alloc);
+            size_t n = safe_read(fd, out->buf + out->len, out->alloc - out->len);
+            if (n == SAFE_READ_ERROR)
+                die(EXIT_FAILURE, errno, "%s", quotef(outfile));
+            if (n == 0)
+                break;
+            out->len += n;
+        }
+        close(fd);
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+/* ---fuzz の本体。 食い違いがあれば、入力を残して EXIT_FAILURE を返す。
+   最後に、読み方ごとの時間と基準との比を出す。 */
+static int
+fuzz_main(void) {
+    static char const flags[] = "benstvAET";
+    static unsigned int const flag_options[] = {
+        CAT_NUMBER | CAT_NUMBER_NONBLANK,
+        CAT_SHOW_NONPRINTING | CAT_SHOW_ENDS,
+        CAT_NUMBER,
+        CAT_SQUEEZE_BLANK,
+        CAT_SHOW_NONPRINTING | CAT_SHOW_TABS,
+        CAT_SHOW_NONPRINTING,
+        CAT_SHOW_NONPRINTING | CAT_SHOW_ENDS | CAT_SHOW_TABS,
+        CAT_SHOW_ENDS,
+        CAT_SHOW_TABS};
+    char self[PATH_MAX];
+    ssize_t self_len = readlink("/proc/self/exe", self, sizeof self - 1);
+    if (self_len < 0)
+        die(EXIT_FAILURE, errno, "/proc/self/exe");
+    self[self_len] = '\0';
+
+    char const *tmp = getenv("TMPDIR");
+    char *dir = xasprintf("%s/cat-fuzz.XXXXXX", tmp && *tmp ? tmp : "/tmp");
+    if (!mkdtemp(dir))
+        die(EXIT_FAILURE, errno, "%s", quotef(dir));
+    char *outfile = xasprintf("%s/out", dir);
+    char *paths[FUZZ_FILES];
+    for (int i = 0; i < FUZZ_FILES; i++)
+        paths[i] = xasprintf("%s/%d", dir, i);
+
+    uint64_t rng = fuzz_seed ? fuzz_seed : (uint64_t) gethrxtime() | 1;
+    printf("seed %ju\n", (uintmax_t) rng);
+    fflush(stdout);
+
+    if (!fuzz_line_counter(&rng))
+        return EXIT_FAILURE;
+
+    scan_special_init();
+    struct fuzz_output expect = {NULL, 0, 0}, got = {NULL, 0, 0};
+    double seconds[FUZZ_ENGINES] = {0};
+    uintmax_t bytes = 0;
+
+    for (uintmax_t it = 0; it < fuzz_iterations; it++) {
+        if (!fuzz_format(&rng, outfile) || !fuzz_feed(&rng, outfile)) {
+            error(0, 0, _("iteration %ju failed"), it);
+            return EXIT_FAILURE;
+        }
+
+        /* オプション、ファイル、標準入力を選ぶ。 "-" は高々1回。 */
+        char opts[sizeof flags + 1] = "-";
+        size_t nopts = 1;
+        unsigned int options = 0;
+        for (int f = 0; flags[f]; f++)
+            if (fuzz_random(&rng) % 4 == 0) {
+                opts[nopts++] = flags[f];
+                options |= flag_options[f];
+            }
+        opts[nopts] = '\0';
+        struct fuzz_reference r = FUZZ_REFERENCE_INITIALIZER(options);
+        expect.len = 0;
+
+        char *args[3 + FUZZ_FILES + 1];
+        int nargs = 0;
+        args[nargs++] = self;
+        if (1 < nopts)
+            args[nargs++] = opts;
+        int engine_arg = nargs++;
+
+        char *in = NULL;
+        size_t in_len = 0;
+        int nfiles = 1 + fuzz_random(&rng) % FUZZ_FILES;
+        int stdin_at = fuzz_random(&rng) % (2 * nfiles);
+        for (int i = 0; i < nfiles; i++) {
+            size_t len;
+            char *data = fuzz_input(&rng, &len);
+            fuzz_reference(&r, data, len, &expect);
+            if (i == stdin_at) {
+                in = data;
+                in_len = len;
+                args[nargs++] = (char *) "-";
+                continue;
+            }
+            int fd = open(paths[i], O_WRONLY | O_CREAT | O_TRUNC, 0600);
+            if (fd < 0 || full_write(fd, data, len) != len || close(fd) != 0)
+                die(EXIT_FAILURE, errno, "%s", quotef(paths[i]));
+            free(data);
+            args[nargs++] = paths[i];
+        }
+        args[nargs] = NULL;
+        uint64_t chunks = fuzz_random(&rng) | 1;
+        bool to_pipe = fuzz_random(&rng) % 2;
+
+        bytes += expect.len;
+        for (int e = 0; e < FUZZ_ENGINES; e++) {
+            args[engine_arg] = (char *) fuzz_engines[e];
+            int status = fuzz_run(self, args, in, in_len, chunks, to_pipe,
+                                  outfile, &got, &seconds[e]);
+            if (status != EXIT_SUCCESS || got.len != expect.len
+                || memcmp(got.buf, expect.buf, expect.len) != 0) {
+                if (in) {
+                    int fd = open(outfile, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+                    if (0 <= fd) {
+                        full_write(fd, in, in_len);
+                        close(fd);
+                    }
+                }
+                error(0, 0, _("iteration %ju: %s %s differs from the "
+                              "reference (status %d, %zu/%zu bytes, output "
+                              "to %s); inputs kept in %s, standard input "
+                              "in %s"),
+                      it, 1 < nopts ? opts : "", fuzz_engines[e], status,
+                      got.len, expect.len, to_pipe ? "pipe" : "file",
+                      quotef_n(0, dir), quotef_n(1, outfile));
+                return EXIT_FAILURE;
             }
         }
+        free(in);
+    }
+
+    /* 速さの比べ。 小さな入力ではプロセスの起動の時間が大きい。 */
+    printf("%ju iterations, %ju bytes of expected output\n",
+           fuzz_iterations, bytes);
+    for (int e = 0; e < FUZZ_ENGINES; e++)
+        printf("%-22s %8.3f s  %5.2fx\n", fuzz_engines[e], seconds[e],
+               seconds[e] / seconds[0]);
+
+    for (int i = 0; i < FUZZ_FILES; i++)
+        unlink(paths[i]);
+    unlink(outfile);
+    rmdir(dir);
+    return EXIT_SUCCESS;
+}
+
+/* --prefetch で、先に開いておくファイルの数の上限。 */
+enum { PREFETCH_MAX = 1024 };
+
+/* 先に開いたファイルに対して、先読みを頼む大きさ。 */
+enum { PREFETCH_BYTES = 2 * 1024 * 1024 };
+
+/* 前のファイルを cat している間に、後ろのファイルを別のスレッドで開いて
+   先読みを頼んでおく。 開いておくのは通常ファイルだけで、開けなかった
+   ファイルはその番が来たときに改めて開くので、エラーは順番どおりに
+   報告される。 */
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool active;
+    char **argv;
+    int argc;
+    int open_mode;
+    int window;     /* 先に開いておくファイルの数 */
+    int next;       /* 次に開く argv の番号 */
+    int busy;       /* 開いている途中の番号。 なければ -1 */
+    int current;    /* cat している番号 */
+    int *fds;       /* 開いた記述子。 argv の番号ごと、なければ -1 */
+    pthread_t tid;
+} prefetch = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER
+};
+
+/* NAME が通常ファイルなら開いて先読みを頼み、記述子を返す。 そうで
+   なければ -1 を返す。 FIFO などを開いて止まらないように、先に stat で
+   調べ、O_NONBLOCK で開く。 */
+static int
+prefetch_open(char const *name) {
+    struct stat st;
+    if (STREQ(name, "-") || stat(name, &st) != 0 || !S_ISREG(st.st_mode))
+        return -1;
+
+    int fd = open(name, prefetch.open_mode | O_NONBLOCK);
+    if (fd < 0)
+        return -1;
+    int flags = fcntl(fd, F_GETFL);
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || flags < 0
+        || fcntl(fd, F_SETFL, flags & ~O_NONBLOCK) != 0) {
+        close(fd);
+        return -1;
+    }
+    fdadvise(fd, 0, PREFETCH_BYTES, FADVISE_WILLNEED);
+    return fd;
+}
+
+static void *
+prefetch_thread(void *arg) {
+    (void) arg;
+    pthread_mutex_lock(&prefetch.lock);
+    while (true) {
+        while (prefetch.next < prefetch.argc
+               && prefetch.current + prefetch.window < prefetch.next)
+            pthread_cond_wait(&prefetch.cond, &prefetch.lock);
+        /* 追い越されたファイルは、もう開いても使われない。 */
+        if (prefetch.next <= prefetch.current)
+            prefetch.next = prefetch.current + 1;
+        if (prefetch.argc <= prefetch.next)
+            break;
+
+        int i = prefetch.next;
+        prefetch.busy = i;
+        pthread_mutex_unlock(&prefetch.lock);
+        int fd = prefetch_open(prefetch.argv[i]);
+        pthread_mutex_lock(&prefetch.lock);
+        prefetch.fds[i] = fd;
+        prefetch.busy = -1;
+        prefetch.next++;
+        pthread_cond_broadcast(&prefetch.cond);
     }
+    pthread_mutex_unlock(&prefetch.lock);
+    return NULL;
+}
+
+/* ARGV[FIRST] から ARGC の手前までのファイルの先読みを始める。 */
+static void
+prefetch_start(char **argv, int first, int argc, int open_mode) {
+    if (prefetch.window == 0 || argc - first < 2)
+        return;
+    prefetch.argv = argv;
+    prefetch.argc = argc;
+    prefetch.open_mode = open_mode;
+    prefetch.next = first + 1;
+    prefetch.busy = -1;
+    prefetch.current = first;
+    prefetch.fds = xnmalloc(argc, sizeof *prefetch.fds);
+    for (int i = 0; i < argc; i++)
+        prefetch.fds[i] = -1;
+    prefetch.active = pthread_create(&prefetch.tid, NULL, prefetch_thread,
+                                     NULL) == 0;
+    if (!prefetch.active)
+        free(prefetch.fds);
+}
+
+/* ARGV[ARGIND] の番が来た。 先に開いてあればその記述子を返し、
+   なければ -1 を返す。 */
+static int
+prefetch_take(int argind) {
+    if (!prefetch.active)
+        return -1;
+    pthread_mutex_lock(&prefetch.lock);
+    prefetch.current = argind;
+    pthread_cond_broadcast(&prefetch.cond);
+    while (prefetch.busy == argind)
+        pthread_cond_wait(&prefetch.cond, &prefetch.lock);
+    int fd = argind < prefetch.next ? prefetch.fds[argind] : -1;
+    if (argind < prefetch.next)
+        prefetch.fds[argind] = -1;
+    pthread_mutex_unlock(&prefetch.lock);
+    return fd;
+}
+
+/* 先読みのスレッドを止める。 */
+static void
+prefetch_end(void) {
+    if (!prefetch.active)
+        return;
+    pthread_mutex_lock(&prefetch.lock);
+    prefetch.argc = 0;
+    pthread_cond_broadcast(&prefetch.cond);
+    pthread_mutex_unlock(&prefetch.lock);
+    pthread_join(prefetch.tid, NULL);
+    for (int i = 0; i < prefetch.next; i++)
+        if (0 <= prefetch.fds[i])
+            close(prefetch.fds[i]);
+    free(prefetch.fds);
+    prefetch.active = false;
 }
 
 int main(int argc, char **argv) {
@@ -532,6 +3772,8 @@ int main(int argc, char **argv) {
 
     bool out_isreg;//出力がプレーンファイルであるかどうかのフラグ
 
+    bool out_isfifo;//出力がパイプであるかどうかのフラグ
+
     /* 標準入力を読んだことがある場合は、非ゼロとする。 */
     bool have_read_stdin = false;//標準入力から読むかどうかのフラグ
 
@@ -544,6 +3786,10 @@ int main(int argc, char **argv) {
     bool show_ends = false;//-E
     bool show_nonprinting = false;//-v
     bool show_tabs = false;//-T
+    unsigned int number_width = 6;//行番号の幅
+    uintmax_t number_start = 1;//最初の行番号
+    uintmax_t number_increment = 1;//行番号の増分
+    char const *number_separator = "\t";//行番号の後ろの区切り
     int file_open_mode = O_RDONLY;//ファイルモードを保持するビットマップ．
 
     static struct option const long_options[] =
@@ -562,6 +3808,26 @@ int main(int argc, char **argv) {
             {"show-tabs", no_argument, NULL, 'T'},
             //-vETと同じ
             {"show-all", no_argument, NULL, 'A'},
+            //入力の読み方を選ぶ
+            {"io-engine", required_argument, NULL, IO_ENGINE_OPTION},
+            {"parallel", optional_argument, NULL, PARALLEL_OPTION},
+            {"ring-depth", required_argument, NULL, RING_DEPTH_OPTION},
+            {"writev", no_argument, NULL, WRITEV_OPTION},
+            {"prefetch", required_argument, NULL, PREFETCH_OPTION},
+            {"huge-pages", no_argument, NULL, HUGE_PAGES_OPTION},
+            {"adaptive-io", optional_argument, NULL, ADAPTIVE_IO_OPTION},
+            {"direct", no_argument, NULL, DIRECT_OPTION},
+            {"nocache", no_argument, NULL, NOCACHE_OPTION},
+            {"stats", optional_argument, NULL, STATS_OPTION},
+            {"perf-counters", no_argument, NULL, PERF_COUNTERS_OPTION},
+            {"number-width", required_argument, NULL, NUMBER_WIDTH_OPTION},
+            {"number-start", required_argument, NULL, NUMBER_START_OPTION},
+            {"number-increment", required_argument, NULL,
+             NUMBER_INCREMENT_OPTION},
+            {"number-separator", required_argument, NULL,
+             NUMBER_SEPARATOR_OPTION},
+            {"-microbench", no_argument, NULL, MICROBENCH_OPTION},
+            {"-fuzz", optional_argument, NULL, FUZZ_OPTION},
             {GETOPT_HELP_OPTION_DECL},
             {GETOPT_VERSION_OPTION_DECL},
             {NULL, 0, NULL, 0}};
@@ -575,6 +3841,8 @@ int main(int argc, char **argv) {
     // case_GETOPT_HELP_CHAR or case_GETOPT_VERSION_CHAR code.を経由して標準出力を閉じるように手配して。
     atexit(close_stdout);//きちんと標準出力が閉じられるようにする
 
+    scan_special_init();//CPUに合わせて走査関数を選ぶ
+
     while ((c = getopt_long(argc, argv, "benstuvAET", long_options, NULL)) != -1) {
         switch (c) {
             case 'b'://空行以外に行番号を付ける。-n より優先される
@@ -622,6 +3890,115 @@ int main(int argc, char **argv) {
                 show_tabs = true;//-T
                 break;
 
+            case IO_ENGINE_OPTION://入力の読み方
+                io_engine = XARGMATCH("--io-engine", optarg,
+                                      io_engine_args, io_engine_types);
+                break;
+
+            case PARALLEL_OPTION://通常ファイルを複数のスレッドで整形する
+                parallel_threads = (optarg
+                                    ? xdectoumax(optarg, 1, SIZE_MAX / 2, "",
+                                                 _("invalid number of threads"), 0)
+                                    : num_processors(NPROC_CURRENT_OVERRIDABLE));
+                break;
+
+            case RING_DEPTH_OPTION://別のスレッドで読んでおくブロックの数
+                ring_depth = xdectoumax(optarg, 1, RING_DEPTH_MAX, "",
+                                        _("invalid ring depth"), 0);
+                break;
+
+            case WRITEV_OPTION://入力の切れ端を writev で直接書き出す
+                gather.active = true;
+                break;
+
+            case PREFETCH_OPTION://後ろのファイルを先に開いておく数
+                prefetch.window = xdectoumax(optarg, 0, PREFETCH_MAX, "",
+                                             _("invalid number of files"), 0);
+                break;
+
+            case HUGE_PAGES_OPTION://バッファを透過的ヒュージページにする
+                huge_pages = true;
+                break;
+
+            case ADAPTIVE_IO_OPTION://読み込みの大きさを測って決める
+                adaptive.enabled = true;
+                if (optarg) {
+                    // MIN:MAX のどちらかは省略できる
+                    char *colon = strchr(optarg, ':');
+                    if (colon)
+                        *colon = '\0';
+                    if (*optarg)
+                        adaptive.min = xdectoumax(optarg, 512, SIZE_MAX / 8,
+                                                  "KMG", _("invalid I/O size"), 0);
+                    if (colon && colon[1])
+                        adaptive.max = xdectoumax(colon + 1, 512, SIZE_MAX / 8,
+                                                  "KMG", _("invalid I/O size"), 0);
+                    if (adaptive.max < adaptive.min) {
+                        error(0, 0, _("minimum I/O size exceeds the maximum"));
+                        usage(EXIT_FAILURE);
+                    }
+                }
+                break;
+
+            case DIRECT_OPTION://ページキャッシュを通さずに読む
+                direct_io = true;
+                break;
+
+            case NOCACHE_OPTION://読み書きしたページをキャッシュから落とす
+                nocache = true;
+                break;
+
+            case STATS_OPTION://I/O の統計を出す
+                stats_mode = (optarg
+                              ? XARGMATCH("--stats", optarg, stats_args,
+                                          stats_types)
+                              : STATS_TEXT);
+                break;
+
+            case PERF_COUNTERS_OPTION://段階ごとにハードウェアカウンタを数える
+                perf_counters = true;
+                break;
+
+            case NUMBER_WIDTH_OPTION://行番号の幅
+                number_width = xdectoumax(optarg, 1, LINE_COUNTER_FIELD, "",
+                                          _("invalid line number field width"),
+                                          0);
+                break;
+
+            case NUMBER_START_OPTION://最初の行番号
+                number_start = xdectoumax(optarg, 0, UINTMAX_MAX, "",
+                                          _("invalid starting line number"), 0);
+                break;
+
+            case NUMBER_INCREMENT_OPTION://行番号の増分
+                number_increment = xdectoumax(optarg, 0, UINTMAX_MAX, "",
+                                              _("invalid line number increment"),
+                                              0);
+                break;
+
+            case NUMBER_SEPARATOR_OPTION://行番号の後ろの区切り
+                number_separator = optarg;
+                break;
+
+            case MICROBENCH_OPTION://整形の核をメモリ上で測る
+                microbench = true;
+                break;
+
+            case FUZZ_OPTION://読み方ごとの出力を比べる
+                fuzz = true;
+                if (optarg) {
+                    // N:SEED の SEED は省略できる
+                    char *colon = strchr(optarg, ':');
+                    if (colon)
+                        *colon = '\0';
+                    fuzz_iterations = xdectoumax(optarg, 1, UINTMAX_MAX, "",
+                                                 _("invalid number of iterations"), 0);
+                    if (colon)
+                        fuzz_seed = xdectoumax(colon + 1, 1, UINT64_MAX, "",
+                                               _("invalid seed"), 0);
+                }
+                break;
+
                 case_GETOPT_HELP_CHAR;// --helpを処理
 
                 case_GETOPT_VERSION_CHAR(PROGRAM_NAME, AUTHORS);
@@ -633,6 +4010,41 @@ int main(int argc, char **argv) {
         }
     }
 
+    if (microbench)
+        return microbench_run();
+    if (fuzz)
+        return fuzz_main();
+
+    /* 読み込みの大きさを測るときや O_DIRECT で読むときは、read の
+       ループだけを使う。 */
+    if (adaptive.enabled || direct_io) {
+        io_engine = IO_ENGINE_READ;
+        ring_depth = 0;
+    }
+
+    /* --nocache では、読み書きの位置が追える read と write のループを
+       使う。 */
+    if (nocache)
+        io_engine = IO_ENGINE_READ;
+
+    if (perf_counters)
+        perf_start();
+
+    /* -v ではすべてのバイトを変換し直すので、--writev の意味がない。 */
+    if (show_nonprinting)
+        gather.active = false;
+
+    cat_ctx_init(&stdout_ctx, ((number ? CAT_NUMBER : 0)
+                               | (number_nonblank ? CAT_NUMBER_NONBLANK : 0)
+                               | (squeeze_blank ? CAT_SQUEEZE_BLANK : 0)
+                               | (show_ends ? CAT_SHOW_ENDS : 0)
+                               | (show_tabs ? CAT_SHOW_TABS : 0)
+                               | (show_nonprinting ? CAT_SHOW_NONPRINTING : 0)));
+    if (!cat_ctx_set_numbering(&stdout_ctx, number_width, number_start,
+                               number_increment, number_separator))
+        die(EXIT_FAILURE, 0, _("line number separator is longer than %d bytes"),
+            (int) LINE_COUNTER_SEP_MAX);
+
     // 標準出力に関する情報を取得
     if (fstat(STDOUT_FILENO, &stat_buf) < 0)
     // 失敗したら
@@ -642,6 +4054,9 @@ int main(int argc, char **argv) {
     out_dev = stat_buf.st_dev;
     out_ino = stat_buf.st_ino;
     out_isreg = S_ISREG(stat_buf.st_mode) != 0;
+    out_isfifo = S_ISFIFO(stat_buf.st_mode) != 0;
+    if (nocache && out_isreg)
+        nocache_output_start();
 
     if (!(number || show_ends || squeeze_blank)) {
       // 行番号出力、行の最後に$、連続した空行の出力を行わない。
@@ -657,7 +4072,24 @@ int main(int argc, char **argv) {
     infile = "-";
     argind = optind;//catする引数のargvインデックス
 
+    // --io-engine=io_uring でオプションがなければ、小さなファイルを
+    // まとめて読む。 前のファイルを書き出す前に後ろのファイルを読むので、
+    // auto では行わない。 そうでなければ、--prefetch で頼まれたときに、
+    // 後ろのファイルを別のスレッドで開いて、先読みを頼んでおく
+    if (!(number || show_ends || show_nonprinting || show_tabs || squeeze_blank)
+        && ring_depth == 0 && io_engine == IO_ENGINE_IO_URING)
+        small_files_start(argv, argind, argc, file_open_mode, out_isreg,
+                          out_dev, out_ino);
+    if (!small.active && !direct_io && !nocache)
+        prefetch_start(argv, argind, argc, file_open_mode);
+
     do {
+        // まとめて読んでおいた小さなファイルなら、出力に加えるだけ
+        if (small_files_take(argind)) {
+            stats_file_end(argv[argind]);
+            continue;
+        }
+
         if (argind < argc)//オプションをすべて解析したあとの、
         // オプションではない引数がargcより小さいというのは、
         // 最後にファイル名が指定されたということ
@@ -672,7 +4104,9 @@ int main(int argc, char **argv) {
                 xset_binary_mode(STDIN_FILENO, O_BINARY);
         } else {
           // ファイルから読む
-            input_desc = open(infile, file_open_mode);
+            input_desc = prefetch_take(argind);
+            if (input_desc < 0)
+                input_desc = open(infile, file_open_mode);
             if (input_desc < 0) {
               // openできなかったときのエラー処理
                 error(0, errno, "%s", quotef(infile));
@@ -689,8 +4123,19 @@ int main(int argc, char **argv) {
             goto contin;
         }
         insize = io_blksize(stat_buf);//最適なブロックサイズを取得する
+        if (adaptive.enabled) {
+            // バッファは最大の大きさで取り、読み込みの大きさは adaptive_read() が決める
+            insize = adaptive.max;
+            adaptive_start();
+        }
 
-        fdadvise(input_desc, 0, 0, FADVISE_SEQUENTIAL);
+        // O_DIRECT の読み込みは境界に揃ったバッファに入れる
+        if (direct_io && S_ISREG(stat_buf.st_mode))
+            direct_input_start(page_size);
+        else
+            fdadvise(input_desc, 0, 0, FADVISE_SEQUENTIAL);
+        if (nocache && S_ISREG(stat_buf.st_mode))
+            nocache_input_start();
 
         /* 空でない通常ファイルをそれ自体にコピーしてはいけない、それは単に出力デバイスを使い果たすだけだからだ。このエラーは、後で発見するよりも、早めに発見する方がよいでしょう。 */
 
@@ -702,12 +4147,61 @@ int main(int argc, char **argv) {
 
         /* フォーマット指向のオプションが与えられている場合は 'cat' を、そうでない場合は 'simple_cat' を使用します。 */
         if (!(number || show_ends || show_nonprinting || show_tabs || squeeze_blank)) {
-            insize = MAX(insize, outsize);
-            inbuf = xmalloc(insize + page_size - 1);
-// ptr_align() 返されたポインタがメモリアラインされていることを確認する
-            ok &= simple_cat(ptr_align(inbuf, page_size), insize);
+            // まずカーネル内でのコピーを試し、使えなければ read/write のループに戻る
+            int copy_cat_status = 0;
+            if (io_engine == IO_ENGINE_AUTO && ring_depth == 0)
+                copy_cat_status = zero_copy_cat(S_ISREG(stat_buf.st_mode),
+                                                S_ISFIFO(stat_buf.st_mode),
+                                                out_isreg, out_isfifo);
+            if (copy_cat_status != 0) {
+                ok &= 0 < copy_cat_status;
+            } else {
+                insize = MAX(insize, outsize);
+                inbuf = io_buffer_get(&in_buffer, insize, page_size);
+                // 書いている間に次のブロックを別のスレッドか io_uring で読んでおく
+                if (ring_depth != 0)
+                    ring_input_start(insize);
+                if (!ring_in.active && S_ISREG(stat_buf.st_mode)
+                    && (io_engine == IO_ENGINE_AUTO || io_engine == IO_ENGINE_IO_URING))
+                    uring_input_start(insize);
+// io_buffer_get() の返すバッファはページ境界に揃っている
+                ok &= simple_cat(inbuf, insize);
+                ring_input_end();
+                uring_input_end();
+            }
         } else {
-            inbuf = xmalloc(insize + 1 + page_size - 1);
+            /* 大きな通常ファイルは、最後の区切りまでを並列に整形する。
+               パイプなどは、読みながらブロックごとに並列に整形する。 */
+            if (1 < parallel_threads && S_ISREG(stat_buf.st_mode)
+                && !direct_io && !nocache
+                && !parallel_cat(stat_buf.st_size, stdout_ctx.options)) {
+                ok = false;
+                goto contin;
+            }
+            if (1 < parallel_threads && !S_ISREG(stat_buf.st_mode)) {
+                int r = pipeline_cat(insize, stdout_ctx.options);
+                if (0 <= r) {
+                    ok &= r;
+                    goto contin;
+                }
+            }
+
+            inbuf = io_buffer_get(&in_buffer, insize + 1, page_size);
+
+            /* --io-engine=mmap なら、通常ファイルは mmap の窓から直接
+               整形する。 inbuf は INSIZE より長い行のためにだけ使われる。
+               読んでいる間にファイルが切り詰められると SIGBUS で止まる
+               ので、 auto では選ばない。
+               io_uring を選んだときや --ring-depth のときは、整形している
+               間に次のブロックを読んでおく。 */
+            if (ring_depth != 0)
+                ring_input_start(insize);
+            if (!ring_in.active && S_ISREG(stat_buf.st_mode)) {
+                if (io_engine == IO_ENGINE_IO_URING)
+                    uring_input_start(insize);
+                else if (io_engine == IO_ENGINE_MMAP)
+                    mmap_input_start(stat_buf.st_size);
+            }
 
             /* Why are
                (OUTSIZE - 1 + INSIZE * 4 + LINE_COUNTER_BUF_LEN + PAGE_SIZE - 1)
@@ -729,21 +4223,27 @@ int main(int argc, char **argv) {
 
                Align the output buffer to a page size boundary, for efficiency
                on some paging implementations, so add PAGE_SIZE - 1 bytes to the
-               request to make room for the alignment.  */
+               request to make room for the alignment.  io_buffer_get() does
+               that, and keeps the buffer for the following files.  */
 
-            outbuf = xmalloc(outsize - 1 + insize * 4 + LINE_COUNTER_BUF_LEN + page_size - 1);
+            outbuf = io_buffer_get(&out_buffer,
+                                   outsize - 1 + insize * 4 + LINE_COUNTER_BUF_LEN,
+                                   page_size);
 
-            ok &= cat(ptr_align(inbuf, page_size), insize,
-                      ptr_align(outbuf, page_size), outsize, show_nonprinting,
-                      show_tabs, number, number_nonblank, show_ends,
-                      squeeze_blank);
+            xtime_t start = stats_clock();
+            xtime_t io_time = file_stats.read_time + file_stats.write_time;
+            ok &= cat(inbuf, insize, outbuf, outsize, stdout_ctx.options);
+            stats_format(start, io_time);
 
-            free(outbuf);
+            mmap_input_end();
+            uring_input_end();
+            ring_input_end();
         }
 
-        free(inbuf);
-
     contin:
+        direct_input_end();
+        nocache_input_end();
+        stats_file_end(infile);
         if (!STREQ(infile, "-") && close(input_desc) < 0) {
             error(0, errno, "%s", quotef(infile));
             ok = false;
@@ -751,6 +4251,11 @@ int main(int argc, char **argv) {
     } while (++argind < argc);//catする引数のインデックスを次にすすめて、
     // それがargcよりも小さい間繰り返す。すなわち、すべてのファイルを処理する
 
+    small_files_end();
+    prefetch_end();
+    stats_end();
+    perf_report();
+
     if (have_read_stdin && close(STDIN_FILENO) < 0)
     // 標準入力から読んでいて、それが正常に閉じれなかった場合
         die(EXIT_FAILURE, errno, _("closing standard input"));
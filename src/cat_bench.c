@@ -0,0 +1,437 @@
+/* cat_bench -- cat の実装を同じ入力で比べるベンチマーク
+
+   合成した入力 (バイナリ、短い行、とても長い行、空行ばかり、タブばかり、
+   上位ビットの立ったバイト) を作り、与えた cat の実装それぞれを、
+   オプションの組 (なし, -n, -b, -s, -E, -T, -v, -A) と出力先
+   (/dev/null, パイプ, ファイル) のすべての組み合わせで走らせる。
+   1つの組み合わせにつき何回か測り、GB/s の平均と 95% 信頼区間を出す。
+
+   -w FILE で結果を基準として保存し、-b FILE で保存した基準と比べて
+   遅くなった組み合わせに REGRESSION と印を付ける。 そのときは
+   終了ステータスが 1 になる。
+
+   ほかのソースと違って gnulib を使わないので、単体でビルドできる:
+
+     cc -O2 -o cat_bench src/cat_bench.c -lm
+     ./cat_bench ./cat ./my_cat1 ./my_cat2  */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PROGRAM_NAME "cat_bench"
+
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define STREQ(a, b) (strcmp(a, b) == 0)
+
+/* 既定の入力の大きさと、1つの組み合わせを測る回数。 */
+enum { DEFAULT_SIZE = 64 * 1024 * 1024, DEFAULT_RUNS = 5 };
+
+/* 既定で、基準より何パーセント遅ければ遅くなったとみなすか。 */
+enum { DEFAULT_THRESHOLD = 5 };
+
+/* 入力を作ったり、パイプから読んだりするバッファの大きさ。 */
+enum { BENCH_BUFSIZE = 1024 * 1024 };
+
+static char const *const option_sets[] = {
+    "", "-n", "-b", "-s", "-E", "-T", "-v", "-A"};
+
+enum sink { SINK_NULL, SINK_PIPE, SINK_FILE, SINKS };
+
+static char const *const sink_names[SINKS] = {"null", "pipe", "file"};
+
+/* 入力の種類ごとに、次の1行 (バイナリなら次の塊) を SIZE バイトの
+   BUF に作って、その長さを返す。 */
+typedef size_t (*corpus_gen)(char *buf, size_t size);
+
+static size_t
+gen_binary(char *buf, size_t size) {
+    for (size_t i = 0; i < size; i++)
+        buf[i] = random();
+    return size;
+}
+
+static size_t
+gen_short(char *buf, size_t size) {
+    size_t len = random() % MIN(20, size);
+    for (size_t i = 0; i < len; i++)
+        buf[i] = 'a' + random() % 26;
+    buf[len] = '\n';
+    return len + 1;
+}
+
+static size_t
+gen_long(char *buf, size_t size) {
+    size_t len = size / 2 + random() % (size / 2);
+    for (size_t i = 0; i < len; i++)
+        buf[i] = ' ' + random() % 95;
+    buf[len] = '\n';
+    return len + 1;
+}
+
+static size_t
+gen_blank(char *buf, size_t size) {
+    /* 10行に1行だけ中身がある。 */
+    if (random() % 10)
+        return buf[0] = '\n', 1;
+    return gen_short(buf, size);
+}
+
+static size_t
+gen_tabs(char *buf, size_t size) {
+    size_t len = random() % MIN(80, size);
+    for (size_t i = 0; i < len; i++)
+        buf[i] = random() % 3 ? '\t' : 'a' + random() % 26;
+    buf[len] = '\n';
+    return len + 1;
+}
+
+static size_t
+gen_high(char *buf, size_t size) {
+    size_t len = random() % MIN(80, size);
+    for (size_t i = 0; i < len; i++)
+        buf[i] = 128 + random() % 128;
+    buf[len] = '\n';
+    return len + 1;
+}
+
+static struct {
+    char const *name;
+    corpus_gen gen;
+} const corpora[] = {
+    {"binary", gen_binary},
+    {"short", gen_short},
+    {"long", gen_long},
+    {"blank", gen_blank},
+    {"tabs", gen_tabs},
+    {"high", gen_high}
+};
+
+enum { CORPORA = sizeof corpora / sizeof *corpora };
+
+/* 基準として読んだ結果。 */
+struct baseline {
+    char *key;
+    double mean;
+};
+
+static struct baseline *baselines;
+static size_t nbaselines;
+
+static void
+die_errno(char const *what) {
+    fprintf(stderr, "%s: %s: %s\n", PROGRAM_NAME, what, strerror(errno));
+    exit(EXIT_FAILURE);
+}
+
+static _Noreturn void
+usage(int status) {
+    if (status != EXIT_SUCCESS) {
+        fprintf(stderr, "Try '%s -h' for more information.\n", PROGRAM_NAME);
+        exit(status);
+    }
+    printf("Usage: %s [OPTION]... PROGRAM...\n", PROGRAM_NAME);
+    fputs("\
+Run each cat PROGRAM over synthetic inputs with every option set and\n\
+output sink, and report throughput in GB/s with 95% confidence intervals.\n\
+\n\
+  -d DIR     create the inputs and the output file in DIR\n\
+               (default: a new directory under /tmp, removed afterwards)\n\
+  -s BYTES   size of each input (default 64 MiB)\n\
+  -r N       measure each combination N times (default 5)\n\
+  -b FILE    compare with the baseline in FILE and flag regressions\n\
+  -w FILE    save the results as a baseline to FILE\n\
+  -t PCT     flag a regression when slower than the baseline by more\n\
+               than PCT percent (default 5)\n\
+  -h         display this help and exit\n\
+\n\
+Exit status is 1 if a regression was flagged or a program failed.\n\
+", stdout);
+    exit(status);
+}
+
+/* NAME の入力を SIZE バイト作って DIR/NAME に書く。 */
+static char *
+make_corpus(char const *dir, int c, size_t size, char *buf) {
+    char *path;
+    if (asprintf(&path, "%s/%s", dir, corpora[c].name) < 0)
+        die_errno("asprintf");
+    FILE *f = fopen(path, "w");
+    if (!f)
+        die_errno(path);
+
+    srandom(c + 1);
+    for (size_t done = 0; done < size;) {
+        size_t n = MIN(corpora[c].gen(buf, BENCH_BUFSIZE), size - done);
+        if (fwrite(buf, 1, n, f) != n)
+            die_errno(path);
+        done += n;
+    }
+    if (fclose(f) != 0)
+        die_errno(path);
+    return path;
+}
+
+static double
+now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* PROGRAM を OPTS 付きで INPUT に走らせ、出力を SINK に送る。 かかった
+   秒数を返す。 失敗したら負の数を返す。 */
+static double
+run_once(char const *program, char const *opts, char const *input,
+         enum sink sink, char const *outfile, char *buf) {
+    int pipefd[2] = {-1, -1};
+    int out;
+
+    if (sink == SINK_PIPE) {
+        if (pipe(pipefd) != 0)
+            die_errno("pipe");
+        out = pipefd[1];
+    } else if (sink == SINK_FILE) {
+        out = open(outfile, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (out < 0)
+            die_errno(outfile);
+    } else {
+        out = open("/dev/null", O_WRONLY);
+        if (out < 0)
+            die_errno("/dev/null");
+    }
+
+    double start = now();
+    pid_t pid = fork();
+    if (pid < 0)
+        die_errno("fork");
+    if (pid == 0) {
+        char const *argv[4];
+        int argc = 0;
+        argv[argc++] = program;
+        if (*opts)
+            argv[argc++] = opts;
+        argv[argc++] = input;
+        argv[argc] = NULL;
+        if (dup2(out, STDOUT_FILENO) < 0)
+            _exit(127);
+        if (pipefd[0] >= 0)
+            close(pipefd[0]);
+        execv(program, (char *const *) argv);
+        _exit(127);
+    }
+
+    close(out);
+    if (sink == SINK_PIPE) {
+        /* 読む側がいないと cat が止まるので、ここで読み捨てる。 */
+        ssize_t n;
+        while ((n = read(pipefd[0], buf, BENCH_BUFSIZE)) != 0)
+            if (n < 0 && errno != EINTR)
+                die_errno("read");
+        close(pipefd[0]);
+    }
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0)
+        if (errno != EINTR)
+            die_errno("waitpid");
+    double elapsed = now() - start;
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return -1;
+    return elapsed;
+}
+
+/* 自由度 DF の t 分布の両側 95% 点。 */
+static double
+t_quantile(int df) {
+    static double const t[] = {
+        0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262,
+        2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093,
+        2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045,
+        2.042};
+    if (df < (int) (sizeof t / sizeof *t))
+        return t[df];
+    return 1.960;
+}
+
+/* 基準を FILE から読む。 1行に "KEY MEAN" が1つ。 */
+static void
+read_baseline(char const *file) {
+    FILE *f = fopen(file, "r");
+    if (!f)
+        die_errno(file);
+    char key[256];
+    double mean;
+    while (fscanf(f, "%255s %lf", key, &mean) == 2) {
+        baselines = realloc(baselines, (nbaselines + 1) * sizeof *baselines);
+        if (!baselines)
+            die_errno("realloc");
+        baselines[nbaselines].key = strdup(key);
+        baselines[nbaselines].mean = mean;
+        nbaselines++;
+    }
+    fclose(f);
+}
+
+static struct baseline const *
+find_baseline(char const *key) {
+    for (size_t i = 0; i < nbaselines; i++)
+        if (STREQ(baselines[i].key, key))
+            return &baselines[i];
+    return NULL;
+}
+
+int
+main(int argc, char **argv) {
+    char const *dir = NULL;
+    char const *baseline_file = NULL;
+    char const *save_file = NULL;
+    size_t size = DEFAULT_SIZE;
+    int runs = DEFAULT_RUNS;
+    double threshold = DEFAULT_THRESHOLD;
+    int c;
+
+    while ((c = getopt(argc, argv, "d:s:r:b:w:t:h")) != -1) {
+        switch (c) {
+            case 'd':
+                dir = optarg;
+                break;
+            case 's':
+                size = strtoull(optarg, NULL, 10);
+                if (size == 0)
+                    usage(EXIT_FAILURE);
+                break;
+            case 'r':
+                runs = atoi(optarg);
+                if (runs < 2)
+                    usage(EXIT_FAILURE);
+                break;
+            case 'b':
+                baseline_file = optarg;
+                break;
+            case 'w':
+                save_file = optarg;
+                break;
+            case 't':
+                threshold = atof(optarg);
+                break;
+            case 'h':
+                usage(EXIT_SUCCESS);
+            default:
+                usage(EXIT_FAILURE);
+        }
+    }
+    if (argc <= optind)
+        usage(EXIT_FAILURE);
+
+    char tmpdir[] = "/tmp/cat_bench.XXXXXX";
+    if (!dir) {
+        dir = mkdtemp(tmpdir);
+        if (!dir)
+            die_errno("mkdtemp");
+    }
+    if (baseline_file)
+        read_baseline(baseline_file);
+    FILE *save = NULL;
+    if (save_file && !(save = fopen(save_file, "w")))
+        die_errno(save_file);
+
+    char *buf = malloc(BENCH_BUFSIZE);
+    if (!buf)
+        die_errno("malloc");
+
+    char *inputs[CORPORA];
+    for (int i = 0; i < CORPORA; i++)
+        inputs[i] = make_corpus(dir, i, size, buf);
+    char *outfile;
+    if (asprintf(&outfile, "%s/output", dir) < 0)
+        die_errno("asprintf");
+
+    bool failed = false;
+    printf("%-12s %-7s %-3s %-5s %9s %9s\n",
+           "program", "input", "opt", "sink", "GB/s", "+-95%");
+
+    for (int p = optind; p < argc; p++) {
+        char const *name = strrchr(argv[p], '/');
+        name = name ? name + 1 : argv[p];
+
+        for (int i = 0; i < CORPORA; i++)
+            for (size_t o = 0; o < sizeof option_sets / sizeof *option_sets; o++)
+                for (int s = 0; s < SINKS; s++) {
+                    char const *opts = option_sets[o];
+                    double sum = 0, sumsq = 0;
+                    bool ok = true;
+
+                    /* 1回目はキャッシュを温めるだけで数えない。 */
+                    for (int r = -1; r < runs && ok; r++) {
+                        double t = run_once(argv[p], opts, inputs[i], s,
+                                            outfile, buf);
+                        if (t < 0)
+                            ok = false;
+                        else if (0 <= r) {
+                            double rate = size / t / 1e9;
+                            sum += rate;
+                            sumsq += rate * rate;
+                        }
+                    }
+
+                    printf("%-12s %-7s %-3s %-5s ", name, corpora[i].name,
+                           *opts ? opts : "-", sink_names[s]);
+                    if (!ok) {
+                        printf("%9s\n", "FAILED");
+                        failed = true;
+                        continue;
+                    }
+
+                    double mean = sum / runs;
+                    double var = (sumsq - runs * mean * mean) / (runs - 1);
+                    double ci = t_quantile(runs - 1) * sqrt(var < 0 ? 0 : var)
+                                / sqrt(runs);
+                    printf("%9.3f %9.3f", mean, ci);
+
+                    char *key;
+                    if (asprintf(&key, "%s/%s/%s/%s", name, corpora[i].name,
+                                 *opts ? opts : "-", sink_names[s]) < 0)
+                        die_errno("asprintf");
+                    struct baseline const *b = find_baseline(key);
+                    if (b && mean + ci < b->mean * (1 - threshold / 100)) {
+                        printf("  REGRESSION (baseline %.3f)", b->mean);
+                        failed = true;
+                    }
+                    putchar('\n');
+                    fflush(stdout);
+                    if (save)
+                        fprintf(save, "%s %.6f\n", key, mean);
+                    free(key);
+                }
+    }
+
+    if (save && fclose(save) != 0)
+        die_errno(save_file);
+
+    /* 作った入力は、自分で作ったディレクトリごと消す。 */
+    for (int i = 0; i < CORPORA; i++) {
+        unlink(inputs[i]);
+        free(inputs[i]);
+    }
+    unlink(outfile);
+    free(outfile);
+    if (dir == tmpdir)
+        rmdir(dir);
+    free(buf);
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,573 @@
+/* cat の整形の核。 cat.c の cat() と、 cat_feed() で整形するほかの
+   プログラムが共に使う。 */
+#include <pthread.h>
+#include <string.h>
+
+#if defined __x86_64__ && defined __GNUC__
+#include <immintrin.h>
+#define USE_SIMD_SCAN 1
+#endif
+
+#include "cat_format.h"
+
+/* オプションの組ごとの format_lines() の中に、定数の引数ごと展開させる。 */
+#ifdef __GNUC__
+#define ALWAYS_INLINE __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE
+#endif
+
+/* 00 から 99 までの2桁の表。 行番号は下2桁をここから1回のストアで
+   書き換え、100 行に1回だけ全体を書き直す。 */
+#define DIGIT_PAIR(n) {'0' + (n) / 10, '0' + (n) % 10}
+#define DIGIT_PAIR10(n)                                                 \
+    DIGIT_PAIR(n), DIGIT_PAIR((n) + 1), DIGIT_PAIR((n) + 2),            \
+    DIGIT_PAIR((n) + 3), DIGIT_PAIR((n) + 4), DIGIT_PAIR((n) + 5),      \
+    DIGIT_PAIR((n) + 6), DIGIT_PAIR((n) + 7), DIGIT_PAIR((n) + 8),      \
+    DIGIT_PAIR((n) + 9)
+
+static char const digit_pairs[100][2] = {
+    DIGIT_PAIR10(0), DIGIT_PAIR10(10), DIGIT_PAIR10(20), DIGIT_PAIR10(30),
+    DIGIT_PAIR10(40), DIGIT_PAIR10(50), DIGIT_PAIR10(60), DIGIT_PAIR10(70),
+    DIGIT_PAIR10(80), DIGIT_PAIR10(90)};
+
+/* LC の count 番目の行番号を buf に書き直す。 数字は右詰めで区切りの
+   直前に置き、幅に足りなければ前を空白で埋める。 uintmax_t に収まらない
+   行番号は、溢れた値の前に '>' を付けて示す。 */
+static void
+line_counter_render(struct line_counter *lc) {
+    if (lc->count == 0) {
+        lc->low = 100;
+        return;
+    }
+
+    uintmax_t steps = lc->count - 1;
+    bool overflow = (lc->increment != 0
+                     && (UINTMAX_MAX - lc->start) / lc->increment < steps);
+    uintmax_t n = lc->start + steps * lc->increment;
+
+    /* 下2桁だけを書き換えてよいのは、2桁以上あって、下2桁の繰り上がりまで
+       溢れないときだけ。 */
+    lc->low = (n < 10 || overflow || n / 100 == UINTMAX_MAX / 100
+               ? 100 : n % 100);
+
+    char *end = lc->buf + LINE_COUNTER_FIELD;
+    char *p = end;
+    while (n >= 100) {
+        p -= 2;
+        memcpy(p, digit_pairs[n % 100], 2);
+        n /= 100;
+    }
+    if (n >= 10) {
+        p -= 2;
+        memcpy(p, digit_pairs[n], 2);
+    } else
+        *--p = '0' + n;
+    if (overflow)
+        *--p = '>';
+
+    char *print = end - lc->width < p ? end - lc->width : p;
+    memset(print, ' ', p - print);
+    lc->print = print - lc->buf;
+    lc->len = end + lc->sep_len - print;
+}
+
+/* LC を、幅 WIDTH、最初の行番号 START、増分 INCREMENT、区切り SEP で
+   行番号を振る、まだ1つも振っていない状態にする。 WIDTH か SEP が
+   大きすぎれば false を返す。 */
+bool
+line_counter_init(struct line_counter *lc, unsigned int width,
+                  uintmax_t start, uintmax_t increment, char const *sep) {
+    size_t sep_len = strlen(sep);
+    if (width < 1 || LINE_COUNTER_FIELD < width
+        || LINE_COUNTER_SEP_MAX < sep_len)
+        return false;
+
+    memset(lc, 0, sizeof *lc);
+    lc->start = start;
+    lc->increment = increment;
+    lc->step = increment < 100 ? increment : 100;
+    lc->width = width;
+    lc->sep_len = sep_len;
+    memcpy(lc->buf + LINE_COUNTER_FIELD, sep, sep_len);
+    line_counter_set(lc, 0);
+    return true;
+}
+
+/* 次の行番号に進める。 ふつうは下2桁を表から書き換えるだけで済む。 */
+void
+next_line_num(struct line_counter *lc) {
+    unsigned int low = lc->low + lc->step;
+    lc->count++;
+    if (low < 100) {
+        memcpy(lc->buf + LINE_COUNTER_FIELD - 2, digit_pairs[low], 2);
+        lc->low = low;
+    } else
+        line_counter_render(lc);
+}
+
+/* LC がこれまでに振った行番号の数を返す。 */
+uintmax_t
+line_counter_value(struct line_counter const *lc) {
+    return lc->count;
+}
+
+/* LC を、行番号を N 個振った状態にする。 */
+void
+line_counter_set(struct line_counter *lc, uintmax_t n) {
+    lc->count = n;
+    line_counter_render(lc);
+}
+
+/* format_lines() の内側のループで特別扱いが必要なバイトか。改行は常に、
+   TABS ならタブも、CTRL なら32未満と127以上のバイトもそうである。 */
+static inline bool
+is_special(unsigned char c, bool tabs, bool ctrl) {
+    return c == '\n' || (tabs && c == '\t') || (ctrl && (c < 32 || 127 <= c));
+}
+
+/* P から始まる、特別扱いが必要な最初のバイトを返す。 END の直前までの
+   どこかに改行があることを前提にしているので、 END は見ない。 */
+static char *
+scan_special_scalar(char *p, char *end, bool tabs, bool ctrl) {
+    (void) end;
+    while (!is_special(*p, tabs, ctrl))
+        p++;
+    return p;
+}
+
+#if USE_SIMD_SCAN
+/* scan_special_scalar() の SSE2 版。 16 バイトずつ調べ、 END の手前の
+   端数はスカラー版に任せる。 */
+static char *
+scan_special_sse2(char *p, char *end, bool tabs, bool ctrl) {
+    __m128i const nl = _mm_set1_epi8('\n');
+    __m128i const tab = _mm_set1_epi8('\t');
+    __m128i const space = _mm_set1_epi8(' ');
+    __m128i const del = _mm_set1_epi8(127);
+
+    /* 制御文字が続くときにベクトルを読むのは無駄なので、まず1バイト見る。 */
+    if (is_special(*p, tabs, ctrl))
+        return p;
+    for (; p + 16 <= end; p += 16) {
+        __m128i v = _mm_loadu_si128((__m128i const *)p);
+        __m128i m = _mm_cmpeq_epi8(v, nl);
+        if (tabs)
+            m = _mm_or_si128(m, _mm_cmpeq_epi8(v, tab));
+        /* 符号付きで比べると 0..31 と 128..255 が ' ' より小さくなる。 */
+        if (ctrl)
+            m = _mm_or_si128(m, _mm_or_si128(_mm_cmplt_epi8(v, space),
+                                             _mm_cmpeq_epi8(v, del)));
+        int bits = _mm_movemask_epi8(m);
+        if (bits)
+            return p + __builtin_ctz(bits);
+    }
+    return scan_special_scalar(p, end, tabs, ctrl);
+}
+
+/* scan_special_scalar() の AVX2 版。 */
+__attribute__((target("avx2"))) static char *
+scan_special_avx2(char *p, char *end, bool tabs, bool ctrl) {
+    __m256i const nl = _mm256_set1_epi8('\n');
+    __m256i const tab = _mm256_set1_epi8('\t');
+    __m256i const space = _mm256_set1_epi8(' ');
+    __m256i const del = _mm256_set1_epi8(127);
+
+    if (is_special(*p, tabs, ctrl))
+        return p;
+    for (; p + 32 <= end; p += 32) {
+        __m256i v = _mm256_loadu_si256((__m256i const *)p);
+        __m256i m = _mm256_cmpeq_epi8(v, nl);
+        if (tabs)
+            m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, tab));
+        if (ctrl)
+            m = _mm256_or_si256(m, _mm256_or_si256(_mm256_cmpgt_epi8(space, v),
+                                                   _mm256_cmpeq_epi8(v, del)));
+        unsigned bits = _mm256_movemask_epi8(m);
+        if (bits)
+            return p + __builtin_ctz(bits);
+    }
+    return scan_special_sse2(p, end, tabs, ctrl);
+}
+#endif
+
+/* CPU に合わせて scan_special_init() が選ぶ走査関数。 */
+char *(*scan_special)(char *, char *, bool, bool) = scan_special_scalar;
+
+static void
+scan_special_select(void) {
+#if USE_SIMD_SCAN
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        scan_special = scan_special_avx2;
+    else
+        scan_special = scan_special_sse2;
+#endif
+}
+
+/* cpuid を見て scan_special を選ぶ。 何度呼んでも、どのスレッドから
+   呼んでもよい。 */
+void
+scan_special_init(void) {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, scan_special_select);
+}
+
+/* P から END の手前までで、改行でない最初のバイトを返す。 すべて改行
+   なら END を返す。 -s と -b で続く空行をまとめて扱うのに使う。 */
+static inline char *
+skip_newlines(char *p, char *end) {
+#if USE_SIMD_SCAN
+    __m128i const nl = _mm_set1_epi8('\n');
+    for (; p + 16 <= end; p += 16) {
+        __m128i v = _mm_loadu_si128((__m128i const *)p);
+        unsigned bits = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)) ^ 0xffff;
+        if (bits)
+            return p + __builtin_ctz(bits);
+    }
+#endif
+    while (p < end && *p == '\n')
+        p++;
+    return p;
+}
+
+/* -v で1バイトを何に変換するか。 S の先頭 LEN バイトを出力する。
+   32 から 126 までは自分自身、それ以外は ^X, ^?, M-X, M-^X, M-^? になる。
+   タブと改行は呼び出し側で扱う。 */
+struct np_expansion {
+    unsigned char len;
+    char s[4];
+};
+
+#define NP_LEN(c) \
+    ((c) < 32 ? 2 : (c) < 127 ? 1 : (c) == 127 ? 2 : (c) < 128 + 32 ? 4 : (c) < 255 ? 3 : 4)
+#define NP_B0(c) ((c) < 32 ? '^' : (c) < 127 ? (c) : (c) == 127 ? '^' : 'M')
+#define NP_B1(c) ((c) < 32 ? (c) + 64 : (c) < 127 ? 0 : (c) == 127 ? '?' : '-')
+#define NP_B2(c) ((c) < 128 ? 0 : (c) < 128 + 32 ? '^' : (c) < 255 ? (c) - 128 : '^')
+#define NP_B3(c) ((c) < 128 ? 0 : (c) < 128 + 32 ? (c) - 128 + 64 : (c) < 255 ? 0 : '?')
+#define NP(c) {NP_LEN(c), {NP_B0(c), NP_B1(c), NP_B2(c), NP_B3(c)}}
+#define NP4(c) NP(c), NP((c) + 1), NP((c) + 2), NP((c) + 3)
+#define NP16(c) NP4(c), NP4((c) + 4), NP4((c) + 8), NP4((c) + 12)
+#define NP64(c) NP16(c), NP16((c) + 16), NP16((c) + 32), NP16((c) + 48)
+
+/* コンパイル時に作る -v の変換表。 */
+static struct np_expansion const np_table[256] = {
+    NP64(0), NP64(64), NP64(128), NP64(192)};
+
+/* *BPINP から最初の改行までを -v の表記に変換して BPOUT に書き、
+   書き終えた位置を返す。 *BPINP は改行の次に進める。 END の直前までの
+   どこかに改行がなければならない。
+   どのバイトも4バイト書いてから本当の長さだけ進めるが、 outbuf には
+   入力1バイトにつき4バイトの余裕がある。 */
+static inline ALWAYS_INLINE char *
+expand_nonprinting(char **bpinp, char *end, char *bpout, bool show_tabs) {
+    char *bpin = *bpinp;
+    unsigned char ch;
+
+#if USE_SIMD_SCAN
+    /* 16 バイトがすべて印字可能な ASCII なら、1回のストアで済ませる。
+       そうでなくても先頭の印字可能な部分はそのまま使える。 */
+    __m128i const space = _mm_set1_epi8(' ');
+    __m128i const del = _mm_set1_epi8(127);
+    while (bpin + 16 <= end) {
+        __m128i v = _mm_loadu_si128((__m128i const *)bpin);
+        unsigned bits = _mm_movemask_epi8(_mm_or_si128(_mm_cmplt_epi8(v, space),
+                                                       _mm_cmpeq_epi8(v, del)));
+        _mm_storeu_si128((__m128i *)bpout, v);
+        if (!bits) {
+            bpin += 16;
+            bpout += 16;
+            continue;
+        }
+        bpin += __builtin_ctz(bits);
+        bpout += __builtin_ctz(bits);
+        ch = *bpin++;
+        if (ch == '\n')
+            goto done;
+        if (ch == '\t' && !show_tabs)
+            *bpout++ = '\t';
+        else {
+            memcpy(bpout, np_table[ch].s, 4);
+            bpout += np_table[ch].len;
+        }
+    }
+#endif
+
+    while ((ch = *bpin++) != '\n') {
+        if (ch == '\t' && !show_tabs)
+            *bpout++ = '\t';
+        else {
+            memcpy(bpout, np_table[ch].s, 4);
+            bpout += np_table[ch].len;
+        }
+    }
+#if USE_SIMD_SCAN
+done:
+#endif
+    *bpinp = bpin;
+    return bpout;
+}
+
+/* 番兵の改行 EOB を読むか、BPOUT が LIMIT に届くまで、*BPINP からの入力を
+   BPOUT に整形する。 *NEWLINESP と LC は呼び出しをまたいで引き継ぐ状態。
+   戻ったとき *BPINP は次に読む文字を指し、番兵を読んだのなら EOB + 1 に
+   なっている。 新しい BPOUT を返す。
+   OPTIONS が定数になるよう、下の FORMAT_KERNEL でオプションの組ごとに
+   展開し、使わないオプションの分岐を内側のループから取り除く。 */
+static inline ALWAYS_INLINE char *
+format_lines(char **bpinp, char *eob, char *bpout, char const *limit,
+             int *newlinesp, struct line_counter *lc, unsigned int options) {
+    bool show_nonprinting = options & CAT_SHOW_NONPRINTING;
+    bool show_tabs = options & CAT_SHOW_TABS;
+    bool number = options & CAT_NUMBER;
+    bool number_nonblank = options & CAT_NUMBER_NONBLANK;
+    bool show_ends = options & CAT_SHOW_ENDS;
+    bool squeeze_blank = options & CAT_SQUEEZE_BLANK;
+    char *bpin = *bpinp;
+    int newlines = *newlinesp;
+    unsigned char ch = *bpin++;
+
+    while (true) {
+        if (ch == '\n') {
+            /* 番兵なら、入力を足してもらうために戻る。 */
+            if (bpin > eob)
+                break;
+
+            /* 本物の（センチネルではない）改行でした。 */
+            /* 最後の行は空でしたか？
+               (つまり、2つ以上の連続した改行が読み込まれたか) */
+//todo ３．改行文字の処理　行番号の出力や連続する空行の圧縮などが行われます
+            if (++newlines > 0) {
+                if (newlines >= 2) {
+                    /* ここでは2個までとする。 そうでないと、連続した改行が多い場合 連続した改行があると、カウンターはINT_MAXで折り返すことができます。 */
+                    newlines = 2;
+
+                    /* 複数の隣接する空行を同上(-s)で置換する場合、この空行は2行目だったのでしょうか？ */
+                    if (squeeze_blank) {
+                        /* 続く空行も出さないので、まとめて読み飛ばす。 */
+                        bpin = skip_newlines(bpin, eob);
+                        ch = *bpin++;
+                        continue;
+                    }
+                }
+
+                /* 空行(-n)に行番号を書きますか？ */
+
+                if (number && !number_nonblank) {
+                    next_line_num(lc);//行番号バッファを更新する。
+                    bpout = line_counter_put(lc, bpout);
+                }
+            }
+
+            /* (-e).$を出力  */
+
+            if (show_ends)
+                *bpout++ = '$';
+
+            /* 改行を出力.  */
+
+            *bpout++ = '\n';
+
+            /* 行番号を振らない空行が続くなら、出力のバッファに収まる
+               だけまとめて書く。 -s では2つ目の空行から読み飛ばすので
+               ここには来ない。 */
+            if (!squeeze_blank && (!number || number_nonblank)
+                && *bpin == '\n' && bpout < limit) {
+                size_t run = skip_newlines(bpin, eob) - bpin;
+                size_t room = (limit - bpout) / (show_ends + 1);
+                if (room < run)
+                    run = room;
+                if (show_ends) {
+                    /* "$\n" を16バイトずつ、端数は2バイトずつ書く。 */
+                    size_t i = 0;
+                    for (; i + 16 <= 2 * run; i += 16)
+                        memcpy(bpout + i, "$\n$\n$\n$\n$\n$\n$\n$\n", 16);
+                    for (; i < 2 * run; i += 2)
+                        memcpy(bpout + i, "$\n", 2);
+                    bpout += 2 * run;
+                } else {
+                    memset(bpout, '\n', run);
+                    bpout += run;
+                }
+                bpin += run;
+                if (run != 0)
+                    newlines = (newlines == 0 && run == 1 ? 1 : 2);
+            }
+
+            /* 出力バッファが埋まったら、書き出してもらうために戻る。 */
+            if (limit <= bpout)
+                break;
+
+            ch = *bpin++;
+            continue;
+        }
+
+        /* 行頭であり、行番号が要求されているか？ */
+        // newlinesは最後に読み込んだ文字が改行であるかどうかを示す変数。改行が連続で出現した場合、この値はそれらの連続する改行の数になります。最後に読み込んだ文字が改行でなければ、この値は-1になります。したがって、newlines >= 0は新しい行が始まったという状態を示す
+        if (newlines >= 0 && number) {
+            next_line_num(lc);
+            // lc->printは出力するべき行番号の buf の中での開始位置。next_line_num()によって更新され、最新の行番号を常に保持
+            bpout = line_counter_put(lc, bpout);
+            // bpoutは出力バッファの現在のいち。行番号と区切りを書いた後ろを返すので、次の出力は行番号の直後から開始される
+        }
+
+        /* ここでCHは改行文字を含むことができません。 */
+
+        /* バッファが空になったか、適切な改行が見つかったことを意味する改行文字が見つかるまでは、以下のループが続きます。 */
+        /* quoting、すなわち-v、-e、-tのうち少なくとも1つが指定されている場合、 変換が必要な文字列をスキャンします。 */
+        //    4非印刷文字の処理: この部分では、読み込んだ文字が非印刷文字（制御文字やASCII範囲外の文字）だった場合の処理を行っています。具体的には、これらの文字を可視化するための変換が行われます。
+        if (show_nonprinting) {
+            // ch をもう一度読ませて、改行までを表で変換する
+            bpin--;
+            bpout = expand_nonprinting(&bpin, eob + 1, bpout, show_tabs);
+        } else {
+            /* -v, -e, -tのいずれも指定されておらず、引用されていない。 */
+            while (ch != '\n') {
+                if (ch == '\t' && show_tabs) {
+                    *bpout++ = '^';
+                    *bpout++ = ch + 64;//&\t':9 I:73
+                } else {
+                    // 改行と（-Tなら）タブ以外の並びをまとめてコピーする
+                    char *run = bpin - 1;
+                    bpin = scan_special(bpin, eob + 1, show_tabs, false);
+                    memcpy(bpout, run, bpin - run);
+                    bpout += bpin - run;
+                }
+
+                ch = *bpin++;
+            }
+        }
+
+        /* 改行まで読んだ。 次の周回でその改行を処理する。 */
+        newlines = -1;
+        ch = '\n';
+    }
+
+    *bpinp = bpin;
+    *newlinesp = newlines;
+    return bpout;
+}
+
+
+/* format_lines() を展開するオプションの組。 CAT_NUMBER_NONBLANK は
+   CAT_NUMBER と一緒にしか立たないので、 (o & 3) == 2 の組は作らない。 */
+#define FORMAT_KERNELS(X)                                               \
+    X(0) X(1) X(3) X(4) X(5) X(7) X(8) X(9) X(11) X(12) X(13) X(15)    \
+    X(16) X(17) X(19) X(20) X(21) X(23) X(24) X(25) X(27) X(28) X(29)   \
+    X(31) X(32) X(33) X(35) X(36) X(37) X(39) X(40) X(41) X(43) X(44)   \
+    X(45) X(47) X(48) X(49) X(51) X(52) X(53) X(55) X(56) X(57) X(59)   \
+    X(60) X(61) X(63)
+
+#define FORMAT_KERNEL(o)                                                \
+    static char *                                                       \
+    format_lines_##o(char **bpinp, char *eob, char *bpout,              \
+                     char const *limit, int *newlinesp,                 \
+                     struct line_counter *lc) {                         \
+        return format_lines(bpinp, eob, bpout, limit, newlinesp, lc, o); \
+    }
+FORMAT_KERNELS(FORMAT_KERNEL)
+
+#define FORMAT_KERNEL_ENTRY(o) [o] = format_lines_##o,
+static format_lines_fn *const format_kernels[CAT_OPTIONS + 1] = {
+    FORMAT_KERNELS(FORMAT_KERNEL_ENTRY)
+};
+
+/* OPTIONS の組に展開した format_lines() を返す。 */
+format_lines_fn *
+format_lines_select(unsigned int options) {
+    if (options & CAT_NUMBER_NONBLANK)
+        options |= CAT_NUMBER;
+    return format_kernels[options & CAT_OPTIONS];
+}
+
+/* P から番兵の改行 EOB の手前までを OPTIONS で整形しても、何も
+   変わらないか。 行に関わるオプション (-n, -b, -s, -E) があれば改行を
+   含まないこと、 -T ならタブを、 -v ならタブと改行以外の制御文字と
+   8ビット目の立ったバイトを含まないことが条件になる。 行頭の行番号は
+   呼び出し側で扱う。 */
+bool
+format_unchanged(char *p, char *eob, unsigned int options) {
+    bool tabs = options & CAT_SHOW_TABS;
+    bool ctrl = options & CAT_SHOW_NONPRINTING;
+    bool lines = options & (CAT_NUMBER | CAT_SQUEEZE_BLANK | CAT_SHOW_ENDS);
+
+    while ((p = scan_special(p, eob + 1, tabs, ctrl)) < eob) {
+        if (*p == '\n' ? lines : *p != '\t' || tabs)
+            return false;
+        p++;
+    }
+    return true;
+}
+
+/* cat_feed() が一度に番兵付きのバッファへ写して整形する入力の大きさと、
+   出力をまとめて SINK に渡す大きさ。 バッファはスタックに取るので、
+   ストリームごとの状態は struct cat_ctx だけで済む。 */
+enum { CAT_FEED_INSIZE = 4 * 1024, CAT_FEED_OUTSIZE = 16 * 1024 };
+
+/* CTX を、OPTIONS で整形するストリームの始まりの状態にする。 行番号は
+   cat の既定の形になる。 */
+void
+cat_ctx_init(struct cat_ctx *ctx, unsigned int options) {
+    scan_special_init();
+    if (options & CAT_NUMBER_NONBLANK)
+        options |= CAT_NUMBER;
+    ctx->options = options;
+    ctx->format = format_lines_select(options);
+    ctx->newlines = 0;
+    ctx->lc = (struct line_counter) LINE_COUNTER_INITIALIZER;
+}
+
+/* CTX の行番号の形を line_counter_init() と同じ引数で変える。
+   行番号はまだ1つも振っていない状態に戻る。 */
+bool
+cat_ctx_set_numbering(struct cat_ctx *ctx, unsigned int width,
+                      uintmax_t start, uintmax_t increment, char const *sep) {
+    return line_counter_init(&ctx->lc, width, start, increment, sep);
+}
+
+/* IN から LEN バイトを CTX の続きとして整形し、SINK に渡す。 行の途中で
+   切れていてもよく、次の cat_feed() がその続きから整形する。 出力は
+   溜めずに、戻る前にすべて SINK に渡す。 SINK が失敗したら false を返す。
+   そのときどこまで渡したかは分からないので、 CTX を使い続けるなら
+   cat_ctx_init() からやり直す。 */
+bool
+cat_feed(struct cat_ctx *ctx, char const *in, size_t len,
+         struct cat_sink const *sink) {
+    char inbuf[CAT_FEED_INSIZE + 1];
+    char outbuf[CAT_FEED_OUTSIZE - 1 + CAT_FEED_INSIZE * 4
+                + LINE_COUNTER_BUF_LEN];
+    char *limit = outbuf + CAT_FEED_OUTSIZE;
+    char *bpout = outbuf;
+
+    while (len > 0) {
+        size_t n = len < CAT_FEED_INSIZE ? len : CAT_FEED_INSIZE;
+        memcpy(inbuf, in, n);
+        in += n;
+        len -= n;
+
+        char *eob = inbuf + n;
+        char *bpin = inbuf;
+        *eob = '\n';
+        while (bpin <= eob) {
+            bpout = ctx->format(&bpin, eob, bpout, limit, &ctx->newlines,
+                                &ctx->lc);
+            if (limit <= bpout) {
+                if (!sink->write(sink->arg, outbuf, bpout - outbuf))
+                    return false;
+                bpout = outbuf;
+            }
+        }
+    }
+
+    return (bpout == outbuf
+            || sink->write(sink->arg, outbuf, bpout - outbuf));
+}
+
+/* CTX のストリームを終える。 cat_feed() は出力を溜めないので渡すものは
+   残っていない。 CTX は同じオプションと行番号の形で、最初の行番号から
+   使い直せる。 */
+void
+cat_finish(struct cat_ctx *ctx) {
+    ctx->newlines = 0;
+    line_counter_set(&ctx->lc, 0);
+}
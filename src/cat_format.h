@@ -0,0 +1,112 @@
+/* cat の整形の核。 -n, -b, -s, -E, -T, -v の整形を、入出力から切り離して
+   メモリ上のバッファに対して行う。 状態はすべて struct cat_ctx にあるので、
+   1つのプロセスで複数のストリームを並行して整形できる。
+   libc と pthreads (scan_special_init() の pthread_once) だけに依存して
+   いるので、ほかのプログラムに組み込んで使える。  */
+#ifndef CAT_FORMAT_H
+#define CAT_FORMAT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/* 行番号の桁を右詰めで置く欄の幅と、その後ろに付ける区切りの長さの
+   上限。 uintmax_t の20桁と、溢れを示す '>' が欄に収まる。 */
+enum { LINE_COUNTER_FIELD = 24, LINE_COUNTER_SEP_MAX = 8 };
+
+/* 1行に書く行番号と区切りの長さの上限。 line_counter_put() はいつも
+   この長さを書くので、出力のバッファには1行につきこれだけの余裕が要る。 */
+#define LINE_COUNTER_BUF_LEN (LINE_COUNTER_FIELD + LINE_COUNTER_SEP_MAX)
+
+/* 行番号を振る状態。 行番号は count 番目の行に start + (count - 1) *
+   increment で、 nl の -v, -i, -w, -s と同じように幅、最初の値、増分、
+   区切りを選べる。 buf には出力する文字列をそのまま作っておき、ふつうは
+   下2桁の書き換えだけで次の行番号にする。 struct cat_ctx はそれぞれ自分の
+   行番号を持ち、並列に整形するスレッドもそれぞれ自分の行番号を持つ。
+   ポインタを持たないので、構造体ごとコピーしてよい。 */
+struct line_counter {
+    uintmax_t count;           /* これまでに振った行番号の数 */
+    uintmax_t start;           /* 最初の行番号 */
+    uintmax_t increment;       /* 行番号の増分 */
+    unsigned int step;         /* increment。 ただし 100 で頭打ち */
+    unsigned int low;          /* 今の行番号の下2桁。 下2桁だけを
+                                  書き換えられないときは 100 */
+    unsigned char width;       /* 行番号の最小の幅 */
+    unsigned char sep_len;     /* 区切りの長さ */
+    unsigned char print;       /* buf の中で出力を始める位置 */
+    unsigned char len;         /* print から出力する長さ */
+
+    /* [0, LINE_COUNTER_FIELD) が行番号の欄、その後ろが区切り。
+       line_counter_put() が print から LINE_COUNTER_BUF_LEN バイトを
+       読めるだけの大きさを取る。 */
+    char buf[2 * LINE_COUNTER_BUF_LEN];
+};
+
+/* cat の既定の行番号。 "%6ju\t" と同じ形になる。 */
+#define LINE_COUNTER_INITIALIZER                                        \
+    {.start = 1, .increment = 1, .step = 1, .low = 100, .width = 6,    \
+     .sep_len = 1, .buf[LINE_COUNTER_FIELD] = '\t'}
+
+bool line_counter_init(struct line_counter *lc, unsigned int width,
+                       uintmax_t start, uintmax_t increment, char const *sep);
+void next_line_num(struct line_counter *lc);
+uintmax_t line_counter_value(struct line_counter const *lc);
+void line_counter_set(struct line_counter *lc, uintmax_t n);
+
+/* LC の今の行番号と区切りを OUT に書き、その後ろを返す。 長さによらず
+   LINE_COUNTER_BUF_LEN バイトを固定の数のストアで書く。 */
+static inline char *
+line_counter_put(struct line_counter const *lc, char *out) {
+    memcpy(out, lc->buf + lc->print, LINE_COUNTER_BUF_LEN);
+    return out + lc->len;
+}
+
+/* 整形のオプション。 cat のオプションとの対応はコメントのとおり。 */
+enum {
+    CAT_NUMBER = 1 << 0,           /* -n */
+    CAT_NUMBER_NONBLANK = 1 << 1,  /* -b。 CAT_NUMBER も立てる */
+    CAT_SQUEEZE_BLANK = 1 << 2,    /* -s */
+    CAT_SHOW_ENDS = 1 << 3,        /* -E */
+    CAT_SHOW_TABS = 1 << 4,        /* -T */
+    CAT_SHOW_NONPRINTING = 1 << 5, /* -v */
+    CAT_OPTIONS = (1 << 6) - 1
+};
+
+/* 番兵の改行 EOB を読むか、BPOUT が LIMIT に届くまで、*BPINP からの入力を
+   BPOUT に整形する関数。 format_lines_select() がオプションの組ごとに
+   展開したものを返す。 */
+typedef char *format_lines_fn(char **bpinp, char *eob, char *bpout,
+                              char const *limit, int *newlinesp,
+                              struct line_counter *lc);
+
+/* 整形したストリームの状態。 cat_ctx_init() で初期化する。 */
+struct cat_ctx {
+    unsigned int options;      /* CAT_* の論理和 */
+    format_lines_fn *format;   /* options に合わせた整形の関数 */
+    int newlines;              /* 直前に続いた改行の数。 行の途中なら -1 */
+    struct line_counter lc;    /* 最後に振った行番号 */
+};
+
+/* 整形した出力の受け取り手。 WRITE は ARG と、BUF から LEN バイトの
+   出力を受け取り、すべて受け取れたら true を返す。 */
+struct cat_sink {
+    bool (*write)(void *arg, char const *buf, size_t len);
+    void *arg;
+};
+
+void cat_ctx_init(struct cat_ctx *ctx, unsigned int options);
+bool cat_ctx_set_numbering(struct cat_ctx *ctx, unsigned int width,
+                           uintmax_t start, uintmax_t increment,
+                           char const *sep);
+bool cat_feed(struct cat_ctx *ctx, char const *in, size_t len,
+              struct cat_sink const *sink);
+void cat_finish(struct cat_ctx *ctx);
+
+/* 以下は cat が読み込みのバッファに対して直接使う。 */
+extern char *(*scan_special)(char *p, char *end, bool tabs, bool ctrl);
+void scan_special_init(void);
+format_lines_fn *format_lines_select(unsigned int options);
+bool format_unchanged(char *p, char *eob, unsigned int options);
+
+#endif
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <getopt.h>
 #include <sys/types.h>
@@ -6,6 +7,9 @@
 # include <stropts.h>
 #endif
 #include <sys/ioctl.h>
+#ifdef __linux__
+# include <sys/sendfile.h>
+#endif
 
 #include "error.h"
 #include <errno.h>
@@ -15,6 +19,8 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
 #define EXIT_SUCCESS 0
 # define DEV_BSIZE	512
 /* Macros for min/max.  */
@@ -180,6 +186,89 @@ simple_cat (
     }
 }
 
+#ifdef __linux__
+/* Copy at most COPY_MAX bytes per system call; this is
+   min (SSIZE_MAX, SIZE_MAX) truncated to a multiple of 1 GiB.  */
+# define COPY_MAX (MIN (SSIZE_MAX, SIZE_MAX) >> 30 << 30)
+
+/* The ways the kernel can copy without going through a user buffer.  */
+enum zero_copy_method
+{
+  COPY_FILE_RANGE,		/* both ends are regular files */
+  SPLICE,			/* either end is a pipe */
+  SENDFILE			/* the input can be mmapped */
+};
+
+/* Return true if ERR means METHOD cannot handle this pair of files,
+   so the next method should be tried.  */
+static bool
+zero_copy_unsupported (int err)
+{
+  return (err == ENOSYS || err == EOPNOTSUPP || err == ENOTSUP
+          || err == EINVAL || err == EBADF || err == EXDEV
+          || err == ETXTBSY || err == EPERM);
+}
+
+/* Copy 'input_desc' to STDOUT_FILENO with METHOD until end of file.
+   Return 1 if everything was copied, -1 on error, and 0 if METHOD is
+   unusable.  The proc file system may report 0 bytes for a nonempty
+   file, so a 0 on the first call also falls back to read/write.  */
+static int
+zero_copy_loop (enum zero_copy_method method)
+{
+  for (bool some_copied = false; ; some_copied = true)
+    {
+      ssize_t n;
+      switch (method)
+        {
+        case COPY_FILE_RANGE:
+          n = copy_file_range (input_desc, NULL, STDOUT_FILENO, NULL,
+                               COPY_MAX, 0);
+          break;
+        case SPLICE:
+          n = splice (input_desc, NULL, STDOUT_FILENO, NULL, COPY_MAX,
+                      SPLICE_F_MOVE | SPLICE_F_MORE);
+          break;
+        default:
+          n = sendfile (STDOUT_FILENO, input_desc, NULL, COPY_MAX);
+          break;
+        }
+      if (n == 0)
+        return some_copied;
+      if (n < 0)
+        {
+          if (zero_copy_unsupported (errno))
+            return 0;
+          fprintf(stderr, "zero copy error line: %d\n", __LINE__);
+          return -1;
+        }
+    }
+}
+#endif
+
+/* Copy 'input_desc' to STDOUT_FILENO inside the kernel: copy_file_range
+   if both ends are regular files, splice if either end is a pipe, and
+   sendfile otherwise.  Return 1 if successful, -1 on error, and 0 if
+   none of them can be used.  Every method advances the file offsets,
+   so after 0 simple_cat can read on from where the kernel stopped.  */
+
+static int
+zero_copy_cat (bool in_isreg, bool in_isfifo, bool out_isreg, bool out_isfifo)
+{
+#ifdef __linux__
+  int status = 0;
+  if (in_isreg && out_isreg)
+    status = zero_copy_loop (COPY_FILE_RANGE);
+  if (status == 0 && (in_isfifo || out_isfifo))
+    status = zero_copy_loop (SPLICE);
+  if (status == 0 && in_isreg)
+    status = zero_copy_loop (SENDFILE);
+  return status;
+#else
+  return 0;
+#endif
+}
+
 /* Write any pending output to STDOUT_FILENO.
    Pending is defined to be the *BPOUT - OUTBUF bytes starting at OUTBUF.
    Then set *BPOUT to OUTPUT if it's not already that value.  */
@@ -487,6 +576,9 @@ main (int argc, char **argv)
   /* True if the output is a regular file.  */
   bool out_isreg;
 
+  /* True if the output is a pipe.  */
+  bool out_isfifo;
+
   /* Nonzero if we have ever read standard input.  */
   bool have_read_stdin = false;
 
@@ -583,13 +675,14 @@ main (int argc, char **argv)
 
   /* Get device, i-node number, and optimal blocksize of output.  */
 
-  // if (fstat (STDOUT_FILENO, &stat_buf) < 0)
-  //   err();
+  if (fstat (STDOUT_FILENO, &stat_buf) < 0)
+    err();
 
-  // outsize = io_blksize (stat_buf);
-  // out_dev = stat_buf.st_dev;
-  // out_ino = stat_buf.st_ino;
-  // out_isreg = S_ISREG (stat_buf.st_mode) != 0;
+  outsize = io_blksize (stat_buf);
+  out_dev = stat_buf.st_dev;
+  out_ino = stat_buf.st_ino;
+  out_isreg = S_ISREG (stat_buf.st_mode) != 0;
+  out_isfifo = S_ISFIFO (stat_buf.st_mode) != 0;
 
   // if (! (number || show_ends || squeeze_blank))
   //   {
@@ -654,10 +747,23 @@ main (int argc, char **argv)
       if (! (number || show_ends || show_nonprinting
              || show_tabs || squeeze_blank))
         {
-          insize = MAX (insize, outsize);
-          inbuf = malloc (insize + page_size - 1);
+          /* Try an in-kernel copy first.  */
+          int copy_cat_status =
+            zero_copy_cat (S_ISREG (stat_buf.st_mode) != 0,
+                           S_ISFIFO (stat_buf.st_mode) != 0,
+                           out_isreg, out_isfifo);
+          if (copy_cat_status != 0)
+            {
+              inbuf = NULL;
+              ok &= 0 < copy_cat_status;
+            }
+          else
+            {
+              insize = MAX (insize, outsize);
+              inbuf = malloc (insize + page_size - 1);
 
-          ok &= simple_cat (ptr_align (inbuf, page_size), insize);
+              ok &= simple_cat (ptr_align (inbuf, page_size), insize);
+            }
         }
       else
         {
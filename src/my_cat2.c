@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <getopt.h>
 #include <sys/types.h>
@@ -9,6 +10,12 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 
 #define EXIT_SUCCESS 0
 #define DEV_BSIZE 512
@@ -49,6 +56,37 @@ static inline void *ptr_align(void const *ptr, size_t alignment) {
   return (void *) (p1 - (size_t) p1 % alignment);
 }
 
+// ファイルをまたいで使い回すバッファ。足りなくなったときだけ取り直す
+struct io_buffer {
+  char *alloc;
+  char *buf;
+  size_t size;
+};
+static struct io_buffer in_buffer;
+static struct io_buffer out_buffer;
+enum { HUGE_PAGE_SIZE = 2*1024*1024 };
+static bool huge_pages = false;
+enum { HUGE_PAGES_OPTION = CHAR_MAX + 1 };
+
+static char *io_buffer_get(struct io_buffer *b, size_t size, size_t page_size) {
+  if (b->size < size) {
+    size_t align = huge_pages ? HUGE_PAGE_SIZE : page_size;
+    if (huge_pages) size = (size + align - 1) / align * align;
+    free(b->alloc);
+    b->alloc = malloc(size + align - 1);
+    if (b->alloc == NULL) {
+      fprintf(stderr, "malloc error in io_buffer_get\n");
+      exit(EXIT_FAILURE);
+    }
+    b->buf = ptr_align(b->alloc, align);
+    b->size = size;
+#ifdef MADV_HUGEPAGE
+    if (huge_pages) madvise(b->buf, size, MADV_HUGEPAGE);
+#endif
+  }
+  return b->buf;
+}
+
 void usage(int status, char *program_name) {
   if (status != EXIT_SUCCESS) {
     puts("emit_try_help()");
@@ -71,6 +109,7 @@ void usage(int status, char *program_name) {
     -TCFLSH                   Tab文字を^Iとして表示する\n\
     -u                        無視されるオプション\n\
     -v, --show-nonprinting    ^とM-という記法をつかって表示できない文字を置き換えて出力する\n\
+        --huge-pages          バッファを透過的ヒュージページで確保する\n\
     ", stdout);
     printf("\n\
     %s f - g fの内容を出力し、それから標準入力とgの内容を読む\n\
@@ -116,6 +155,62 @@ static bool simple_cat(char *buf, size_t bufsize) {
     }
   }
 }
+#ifdef __linux__
+#define COPY_MAX (MIN(SSIZE_MAX, SIZE_MAX) >> 30 << 30)
+
+enum zero_copy_method { COPY_FILE_RANGE, SPLICE, SENDFILE };
+
+static bool zero_copy_unsupported(int err) {
+  return (err == ENOSYS || err == EOPNOTSUPP || err == ENOTSUP || err == EINVAL
+    || err == EBADF || err == EXDEV || err == ETXTBSY || err == EPERM);
+}
+
+static int zero_copy_loop(enum zero_copy_method method) {
+  for (bool some_copied = false;; some_copied = true) {
+    ssize_t n;
+    switch (method) {
+      case COPY_FILE_RANGE:
+        n = copy_file_range(input_desc, NULL, STDOUT_FILENO, NULL, COPY_MAX, 0);
+        break;
+      case SPLICE:
+        n = splice(input_desc, NULL, STDOUT_FILENO, NULL, COPY_MAX, SPLICE_F_MOVE | SPLICE_F_MORE);
+        break;
+      default:
+        n = sendfile(STDOUT_FILENO, input_desc, NULL, COPY_MAX);
+        break;
+    }
+    if (n == 0) {
+      return some_copied;
+    }
+    if (n < 0) {
+      if (zero_copy_unsupported(errno)) {
+        return 0;
+      }
+      fprintf(stderr, "zero copy error in zero_copy_loop()\n");
+      return -1;
+    }
+  }
+}
+#endif
+
+// カーネル内でコピーする。1: 成功 -1: エラー 0: 使えないので simple_cat() に任せる
+static int zero_copy_cat(bool in_isreg, bool in_isfifo, bool out_isreg, bool out_isfifo) {
+#ifdef __linux__
+  int status = 0;
+  if (in_isreg && out_isreg) {
+    status = zero_copy_loop(COPY_FILE_RANGE);
+  }
+  if (status == 0 && (in_isfifo || out_isfifo)) {
+    status = zero_copy_loop(SPLICE);
+  }
+  if (status == 0 && in_isreg) {
+    status = zero_copy_loop(SENDFILE);
+  }
+  return status;
+#else
+  return 0;
+#endif
+}
 static inline void write_pending(char *outbuf, char **bpout) {
   size_t n_write = *bpout - outbuf;
   if (0 < n_write) {
@@ -313,6 +408,7 @@ int main(int argc, char *argv[]) {
     {"show_ends", no_argument, NULL, 'E'},
     {"show_tabs", no_argument, NULL, 'T'},
     {"show-all", no_argument, NULL, 'A'},
+    {"huge-pages", no_argument, NULL, HUGE_PAGES_OPTION},
     {"help", no_argument, NULL, 'H'},
     {"version", no_argument, NULL, 'V'},
     {NULL, 0, NULL, 0}
@@ -357,6 +453,8 @@ int main(int argc, char *argv[]) {
         show_ends = true; break;
       case 'T':
         show_tabs = true; break;
+      case HUGE_PAGES_OPTION:
+        huge_pages = true; break;
       default:
         usage(EXIT_FAILURE, argv[0]);
     }
@@ -365,6 +463,8 @@ int main(int argc, char *argv[]) {
     fprintf(stderr, "fstat error in main\n");
   }
   outsize = io_blksize(stat_buf);
+  bool out_isreg = S_ISREG(stat_buf.st_mode) != 0;
+  bool out_isfifo = S_ISFIFO(stat_buf.st_mode) != 0;
   infile = "-";
   argind = optind;
 
@@ -390,17 +490,20 @@ int main(int argc, char *argv[]) {
     }
     insize = io_blksize(stat_buf);
     if (!(number || show_ends || show_nonprinting || show_tabs || squeeze_blank)) {
-      insize = MAX(insize, outsize);
-      inbuf = malloc(insize + page_size - 1);
-      ok &= simple_cat(ptr_align(inbuf, page_size), insize);
+      int copy_cat_status = zero_copy_cat(S_ISREG(stat_buf.st_mode) != 0, S_ISFIFO(stat_buf.st_mode) != 0, out_isreg, out_isfifo);
+      if (copy_cat_status != 0) {
+        ok &= 0 < copy_cat_status;
+      } else {
+        insize = MAX(insize, outsize);
+        inbuf = io_buffer_get(&in_buffer, insize, page_size);
+        ok &= simple_cat(inbuf, insize);
+      }
     } else {
-      inbuf = malloc(insize + 1 + page_size - 1);
-      outbuf = malloc(outsize - 1 + insize * 4 + LINE_COUNTER_BUF_LEN + page_size - 1);
-      ok &= cat(ptr_align(inbuf, page_size), insize,
-      ptr_align(outbuf, page_size), outsize, show_nonprinting, show_tabs, number, number_nonblank, show_ends, squeeze_blank);
-      free(outbuf);
+      inbuf = io_buffer_get(&in_buffer, insize + 1, page_size);
+      outbuf = io_buffer_get(&out_buffer, outsize - 1 + insize * 4 + LINE_COUNTER_BUF_LEN, page_size);
+      ok &= cat(inbuf, insize,
+      outbuf, outsize, show_nonprinting, show_tabs, number, number_nonblank, show_ends, squeeze_blank);
     }
-    free(inbuf);
 
     contin:
       if (!STREQ(infile, "-") && close(input_desc) < 0) {